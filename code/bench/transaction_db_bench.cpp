@@ -0,0 +1,495 @@
+/**
+ * Microbenchmarks for transaction_db. Build and run with `make bench`, then `./bench.out`.
+ *
+ * Workloads come from workload_generator with a fixed seed, so numbers are comparable between runs. Arguments are
+ * named in every benchmark, e.g. BM_settle_greedy/accounts:1000/batch:10000/overdraft_pct:5.
+ */
+#include "transaction_db.hpp"
+#include "ingest_queue.hpp"
+#include "workload_generator.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+workload make_workload(const size_t accounts, const size_t transfers, const size_t batch, const int overdraft_pct)
+{
+   workload_options options;
+   options.accounts = accounts;
+   options.transfers_per_transaction = transfers;
+   options.transactions = batch;
+   options.overdraft_fraction = overdraft_pct / 100.0;
+   return generate_workload(options);
+}
+
+/**
+ * Account ids equal their dense index in every workload, so there is nothing to remap.
+ */
+struct accept_all {
+   bool operator()(transfer&) const { return true; }
+};
+
+transaction_db push_all(const workload& w)
+{
+   transaction_db db(w.accounts);
+   for (const auto& t : w.transactions) {
+      db.push_transaction(t);
+   }
+   return db;
+}
+
+void BM_transaction_log(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), state.range(1), 1024, 0);
+   log_arena arena;
+
+   for (auto _ : state) {
+      for (size_t i = 0; i < w.transactions.size(); ++i) {
+         transaction_log tlog(w.transactions[i], i, accept_all(), &arena);
+         benchmark::DoNotOptimize(tlog.size());
+      }
+      arena.reset();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_transaction_log)->ArgNames({"accounts", "transfers"})->ArgsProduct({{1000, 100000}, {1, 4, 8, 16}});
+
+void BM_push_transaction(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), state.range(1), state.range(2), 0);
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db(w.accounts);
+      state.ResumeTiming();
+
+      for (const auto& t : w.transactions) {
+         db.push_transaction(t);
+      }
+      benchmark::ClobberMemory();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_push_transaction)->ArgNames({"accounts", "transfers", "batch"})->ArgsProduct({{1000, 100000}, {2, 8}, {1000, 100000}});
+
+/**
+ * BM_push_transaction with a write-ahead log attached, to compare against the in-memory path.
+ * sync is a wal_sync value: 0 none, 1 settle, 2 push. Batches of 1 push every transaction on its own,
+ * larger batches go through push_transactions and share one group commit.
+ */
+void BM_push_transaction_wal(benchmark::State& state)
+{
+   const workload w = make_workload(1000, 2, 10000, 0);
+   const wal_sync sync = static_cast<wal_sync>(state.range(0));
+   const size_t batch = state.range(1);
+   const char* path = "transaction_db_bench.wal";
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db(w.accounts);
+      db.attach_wal(path, sync);
+      state.ResumeTiming();
+
+      for (size_t i = 0; i < w.transactions.size(); i += batch) {
+         if (batch == 1) {
+            db.push_transaction(w.transactions[i]);
+         } else {
+            const size_t count = std::min(batch, w.transactions.size() - i);
+            db.push_transactions(array_view<const transaction>(w.transactions.data() + i, count));
+         }
+      }
+      benchmark::ClobberMemory();
+   }
+   std::remove(path);
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_push_transaction_wal)->ArgNames({"sync", "batch"})->ArgsProduct({{0, 1}, {1, 100}})
+   ->Args({2, 100})->Args({2, 1000})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/**
+ * BM_push_transaction's workload pushed by producer threads through begin_ingest(), including end_ingest().
+ * With one producer it shows what the locks and tickets cost over the sequential path.
+ */
+void BM_ingest_transaction(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), 2, 100000, 0);
+   const size_t producers = state.range(1);
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db(w.accounts);
+      state.ResumeTiming();
+
+      db.begin_ingest(producers);
+      std::vector<std::thread> threads;
+      for (size_t p = 0; p < producers; ++p) {
+         threads.emplace_back([&db, &w, p, producers]() {
+            for (size_t i = p; i < w.transactions.size(); i += producers) {
+               db.ingest_transaction(w.transactions[i]);
+            }
+         });
+      }
+      for (auto& t : threads) {
+         t.join();
+      }
+      db.end_ingest();
+      benchmark::ClobberMemory();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_ingest_transaction)->ArgNames({"accounts", "producers"})->ArgsProduct({{1000, 100000}, {1, 2, 4, 8}})
+   ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/**
+ * The same workload handed to one apply thread through ingest_queue. A small ring shows what backpressure costs,
+ * full_waits counts the pushes that had to wait for room.
+ */
+void BM_ingest_queue(benchmark::State& state)
+{
+   const workload w = make_workload(1000, 2, 100000, 0);
+   const size_t capacity = state.range(0);
+   const size_t producers = state.range(1);
+   ingest_queue_stats last;
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db(w.accounts);
+      state.ResumeTiming();
+
+      ingest_queue queue(db, capacity);
+      std::vector<std::thread> threads;
+      for (size_t p = 0; p < producers; ++p) {
+         threads.emplace_back([&queue, &w, p, producers]() {
+            for (size_t i = p; i < w.transactions.size(); i += producers) {
+               queue.push(w.transactions[i]);
+            }
+         });
+      }
+      for (auto& t : threads) {
+         t.join();
+      }
+      queue.drain();
+      last = queue.get_stats();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+   state.counters["full_waits"] = last.full_waits;
+   state.counters["max_depth"] = last.max_depth;
+   state.counters["mean_batch"] = last.batch_size.count() ? double(last.batch_size.sum()) / last.batch_size.count() : 0;
+}
+BENCHMARK(BM_ingest_queue)->ArgNames({"capacity", "producers"})->ArgsProduct({{64, 4096}, {1, 4}})
+   ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/**
+ * apply_transaction is private, so the log is applied by rolling back its mirror image (every transfer reversed),
+ * then rolled back for real. Both directions go through the same code path.
+ */
+void BM_apply_rollback(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), state.range(1), 1024, 0);
+   transaction_db db(w.accounts);
+
+   std::vector<transaction_log> logs;
+   std::vector<transaction_log> mirrored;
+   for (size_t i = 0; i < w.transactions.size(); ++i) {
+      transaction reversed = w.transactions[i];
+      for (auto& x : reversed) {
+         std::swap(x.from, x.to);
+      }
+      logs.emplace_back(w.transactions[i], i, accept_all());
+      mirrored.emplace_back(reversed, i, accept_all());
+   }
+
+   for (auto _ : state) {
+      for (size_t i = 0; i < logs.size(); ++i) {
+         db.rollback(mirrored[i]);
+         db.rollback(logs[i]);
+      }
+   }
+   state.SetItemsProcessed(state.iterations() * logs.size());
+}
+BENCHMARK(BM_apply_rollback)->ArgNames({"accounts", "transfers"})->ArgsProduct({{1000, 100000}, {2, 8}});
+
+void settle_batch(benchmark::State& state, const settle_mode mode)
+{
+   const workload w = make_workload(state.range(0), 2, state.range(1), state.range(2));
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      db.set_settle_mode(mode);
+      state.ResumeTiming();
+
+      db.settle();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+
+void BM_settle_greedy(benchmark::State& state)
+{
+   settle_batch(state, settle_mode::greedy);
+}
+BENCHMARK(BM_settle_greedy)->ArgNames({"accounts", "batch", "overdraft_pct"})
+   ->ArgsProduct({{1000, 100000}, {1000, 10000}, {0, 1, 5, 20}})->Unit(benchmark::kMillisecond);
+
+/**
+ * Same as BM_settle_greedy with candidates scored on a pool. min_parallel_candidates is 1, so every round forks.
+ */
+void BM_settle_greedy_threads(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), 2, state.range(1), state.range(2));
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      db.set_settle_threads(state.range(3), 1);
+      state.ResumeTiming();
+
+      db.settle();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_settle_greedy_threads)->ArgNames({"accounts", "batch", "overdraft_pct", "threads"})
+   ->ArgsProduct({{1000}, {10000}, {5, 20}, {1, 2, 4, 8}})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/**
+ * BM_settle_greedy with a snapshot after every settle. The first view copies every page, so one settle happens
+ * before timing starts and the timed one only pays for the pages it touched. The snapshot itself is written in
+ * the background.
+ */
+void BM_settle_snapshot(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), 2, state.range(1), 5);
+   const char* path = "transaction_db_bench.snap";
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db(w.accounts);
+      db.enable_snapshots(path);
+      db.settle();
+      for (const auto& t : w.transactions) {
+         db.push_transaction(t);
+      }
+      state.ResumeTiming();
+
+      db.settle();
+
+      state.PauseTiming();
+      db.wait_for_snapshot();
+      state.ResumeTiming();
+   }
+   std::remove(path);
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_settle_snapshot)->ArgNames({"accounts", "batch"})->ArgsProduct({{1000, 100000}, {1000, 10000}})->Unit(benchmark::kMillisecond);
+
+/**
+ * Readers on several threads pinning the settled version at once: just the pin and the unpin, the balances are not
+ * copied out.
+ */
+void BM_read_snapshot(benchmark::State& state)
+{
+   static transaction_db* db;
+   if (state.thread_index() == 0) {
+      db = new transaction_db(push_all(make_workload(100000, 2, 1000, 1)));
+      db->enable_read_snapshots();
+      db->settle();
+   }
+
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(db->read_balances().is_settled());
+   }
+
+   if (state.thread_index() == 0) {
+      delete db;
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_read_snapshot)->ThreadRange(1, 4);
+
+/**
+ * Greedy settle under every greedy_score policy, on uniform and skewed traffic, with and without payback chains.
+ * 5% of the transactions overdraw either way. dropped_pct is what each policy ends up dropping.
+ */
+void BM_settle_greedy_score(benchmark::State& state)
+{
+   workload_options options;
+   options.accounts = 1000;
+   options.transactions = 10000;
+   options.transfers_per_transaction = 4;
+   options.overdraft_fraction = 0.05;
+   options.zipf_skew = state.range(1) / 10.0;
+   options.chain_fraction = state.range(2) / 100.0;
+   const workload w = generate_workload(options);
+   size_t dropped = 0;
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      db.set_greedy_score(static_cast<greedy_score>(state.range(0)));
+      state.ResumeTiming();
+
+      db.settle();
+
+      state.PauseTiming();
+      dropped = w.transactions.size() - db.get_applied_transactions().size();
+      state.ResumeTiming();
+   }
+   state.counters["dropped_pct"] = 100.0 * dropped / w.transactions.size();
+}
+BENCHMARK(BM_settle_greedy_score)->ArgNames({"policy", "skew_x10", "chain_pct"})
+   ->ArgsProduct({{0, 1, 2, 3}, {0, 11}, {0, 50}})->Unit(benchmark::kMillisecond);
+
+/**
+ * Forward settle over the BM_settle_greedy workloads, with the lookahead window as an extra argument.
+ */
+void BM_settle_forward(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), 2, state.range(1), state.range(2));
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      db.set_settle_mode(settle_mode::forward);
+      db.set_forward_window(state.range(3));
+      state.ResumeTiming();
+
+      db.settle();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_settle_forward)->ArgNames({"accounts", "batch", "overdraft_pct", "window"})
+   ->ArgsProduct({{1000, 100000}, {1000, 10000}, {1, 5, 20}, {0, 64}})->Unit(benchmark::kMillisecond);
+
+/**
+ * Anytime settle with a deadline of deadline_ms after it starts. 0 measures the forward pass it starts from.
+ * dropped_pct reports what it had to give up, to compare against BM_settle_greedy's.
+ */
+void BM_settle_anytime(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), 2, state.range(1), state.range(2));
+   size_t dropped = 0;
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      state.ResumeTiming();
+
+      db.settle(std::chrono::steady_clock::now() + std::chrono::milliseconds(state.range(3)));
+
+      state.PauseTiming();
+      dropped = w.transactions.size() - db.get_applied_transactions().size();
+      state.ResumeTiming();
+   }
+   state.counters["dropped_pct"] = 100.0 * dropped / w.transactions.size();
+}
+BENCHMARK(BM_settle_anytime)->ArgNames({"accounts", "batch", "overdraft_pct", "deadline_ms"})
+   ->ArgsProduct({{1000}, {10000}, {5, 20}, {0, 1, 10}})->Unit(benchmark::kMillisecond);
+
+/**
+ * Beam settle at a few widths and depths. 1 x 1 is the cheapest setting, dropped_pct shows what the wider ones buy.
+ */
+void BM_settle_beam(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), 2, state.range(1), state.range(2));
+   size_t dropped = 0;
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      db.set_settle_mode(settle_mode::beam);
+      db.set_beam(state.range(3), state.range(4));
+      state.ResumeTiming();
+
+      db.settle();
+
+      state.PauseTiming();
+      dropped = w.transactions.size() - db.get_applied_transactions().size();
+      state.ResumeTiming();
+   }
+   state.counters["dropped_pct"] = 100.0 * dropped / w.transactions.size();
+}
+BENCHMARK(BM_settle_beam)->ArgNames({"accounts", "batch", "overdraft_pct", "width", "depth"})
+   ->Args({1000, 1000, 5, 1, 1})->Args({1000, 1000, 5, 4, 3})->Args({1000, 1000, 20, 1, 1})->Args({1000, 1000, 20, 4, 3})
+   ->Args({1000, 10000, 5, 1, 1})->Args({1000, 10000, 5, 4, 3})->Unit(benchmark::kMillisecond);
+
+// branch and bound is exponential in the worst case. Sparse overdrafts finish the search, dense ones on few accounts
+// can run out of nodes, and those scopes are settled greedily, see fallbacks
+void BM_settle_exact(benchmark::State& state)
+{
+   const workload w = make_workload(state.range(0), 2, state.range(1), state.range(2));
+   size_t dropped = 0;
+   size_t fallbacks = 0;
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      db.set_settle_mode(settle_mode::branch_and_bound);
+      state.ResumeTiming();
+
+      db.settle();
+
+      state.PauseTiming();
+      dropped = w.transactions.size() - db.get_applied_transactions().size();
+      fallbacks = db.get_stats().last_settle.exact_fallbacks;
+      state.ResumeTiming();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+   state.counters["dropped_pct"] = 100.0 * dropped / w.transactions.size();
+   state.counters["fallbacks"] = fallbacks;
+}
+BENCHMARK(BM_settle_exact)->ArgNames({"accounts", "batch", "overdraft_pct"})
+   ->ArgsProduct({{100000}, {1000, 10000}, {0, 1}})->Args({1000, 1000, 5})->Args({1000, 10000, 5})->Unit(benchmark::kMillisecond);
+
+/**
+ * README example 4 at scale: half the transactions come in pairs that only restore consistency together.
+ */
+void BM_settle_example4(benchmark::State& state)
+{
+   workload_options options = workload_preset("example4");
+   options.accounts = state.range(0);
+   options.transactions = state.range(1);
+   const workload w = generate_workload(options);
+
+   for (auto _ : state) {
+      state.PauseTiming();
+      transaction_db db = push_all(w);
+      state.ResumeTiming();
+
+      db.settle();
+   }
+   state.SetItemsProcessed(state.iterations() * w.transactions.size());
+}
+BENCHMARK(BM_settle_example4)->ArgNames({"accounts", "batch"})->ArgsProduct({{1000, 100000}, {1000, 10000}})->Unit(benchmark::kMillisecond);
+
+void BM_get_balances(benchmark::State& state)
+{
+   transaction_db db = push_all(make_workload(state.range(0), 2, 1000, 1));
+   db.settle();
+
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(db.get_balances());
+   }
+   state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_get_balances)->ArgNames({"accounts"})->Arg(1000)->Arg(100000);
+
+void BM_get_applied_transactions(benchmark::State& state)
+{
+   transaction_db db = push_all(make_workload(1000, 2, state.range(0), 1));
+   db.settle();
+
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(db.get_applied_transactions());
+   }
+   state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_get_applied_transactions)->ArgNames({"batch"})->Arg(1000)->Arg(100000);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,382 @@
+#include "binary_format.hpp"
+#include "text_reader.hpp"
+#include "text_writer.hpp"
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <unistd.h>
+using namespace std;
+
+// records are copied to and from the file as raw bytes, so the host layout has to be the file layout
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The binary format is read and written in host byte order, which must be little-endian.");
+static_assert(sizeof(account_balance) == 8 && std::is_trivially_copyable<account_balance>::value, "account_balance must match its on-disk record.");
+static_assert(sizeof(transfer) == 12 && std::is_trivially_copyable<transfer>::value, "transfer must match its on-disk record.");
+
+static const char binary_magic[4] = {'T', 'X', 'D', 'B'};
+static const size_t header_size = 16;
+
+/**
+ * @return pointer to the next bytes bytes of file, advancing offset past them.
+ */
+static const char* take(const mapped_file& file, size_t& offset, size_t bytes)
+{
+   if (bytes > file.size() - offset) {
+      throw std::runtime_error("Unexpected end of binary input.");
+   }
+   const char* p = file.data() + offset;
+   offset += bytes;
+   return p;
+}
+
+template<typename T>
+static T read_scalar(const mapped_file& file, size_t& offset)
+{
+   T value;
+   std::memcpy(&value, take(file, offset, sizeof(T)), sizeof(T));
+   return value;
+}
+
+/**
+ * @return view of the next count records of type T, advancing offset past them.
+ */
+template<typename T>
+static array_view<const T> read_array(const mapped_file& file, size_t& offset, uint64_t count)
+{
+   if (count > (file.size() - offset) / sizeof(T)) {
+      throw std::runtime_error("Unexpected end of binary input.");
+   }
+   const char* p = take(file, offset, static_cast<size_t>(count) * sizeof(T));
+   return array_view<const T>(reinterpret_cast<const T*>(p), static_cast<size_t>(count));
+}
+
+/**
+ * Returns the offset just past the header.
+ */
+static size_t check_header(const mapped_file& file, binary_kind kind, const char* path)
+{
+   size_t offset = 0;
+   if (file.size() < header_size || std::memcmp(file.data(), binary_magic, sizeof(binary_magic)) != 0) {
+      throw std::runtime_error(string(path) + " is not a binary transaction file.");
+   }
+   offset += sizeof(binary_magic);
+
+   if (read_scalar<uint32_t>(file, offset) != binary_version) {
+      throw std::runtime_error(string(path) + " has an unsupported binary format version.");
+   }
+   if (read_scalar<uint32_t>(file, offset) != static_cast<uint32_t>(kind)) {
+      static const char* const expected[] = {"", " is not a binary input file.", " is not a binary result file.", " is not a snapshot file."};
+      throw std::runtime_error(string(path) + expected[static_cast<uint32_t>(kind)]);
+   }
+   read_scalar<uint32_t>(file, offset);
+   return offset;
+}
+
+static FILE* create_binary(const char* path, binary_kind kind)
+{
+   FILE* out = std::fopen(path, "wb");
+   if (!out) {
+      throw std::runtime_error(string("Could not create ") + path + ": " + strerror(errno));
+   }
+
+   const uint32_t header[3] = {binary_version, static_cast<uint32_t>(kind), 0};
+   std::fwrite(binary_magic, sizeof(binary_magic), 1, out);
+   std::fwrite(header, sizeof(header), 1, out);
+   return out;
+}
+
+template<typename T>
+static void write_scalar(FILE* out, T value)
+{
+   std::fwrite(&value, sizeof(T), 1, out);
+}
+
+/**
+ * One fwrite for the whole array, the records already have the on-disk layout.
+ */
+template<typename T>
+static void write_array(FILE* out, const T* first, size_t count)
+{
+   if (count != 0) {
+      std::fwrite(first, sizeof(T), count, out);
+   }
+}
+
+/**
+ * Closes out either way, then reports any write that failed along the way.
+ */
+static void finish_binary(FILE* out, const char* what)
+{
+   const bool failed = std::ferror(out) != 0;
+   if (std::fclose(out) != 0 || failed) {
+      throw std::runtime_error(string("Could not write ") + what + ".");
+   }
+}
+
+bool is_binary_file(const char* path)
+{
+   ifstream in(path, ios::binary);
+   if (!in) {
+      throw std::runtime_error(string("Could not open ") + path);
+   }
+
+   char magic[sizeof(binary_magic)];
+   return in.read(magic, sizeof(magic)) && std::memcmp(magic, binary_magic, sizeof(magic)) == 0;
+}
+
+binary_reader::binary_reader(const char* path): file(path), offset(0)
+{
+   offset = check_header(file, binary_kind::input, path);
+}
+
+array_view<const account_balance> binary_reader::read_accounts()
+{
+   return read_array<account_balance>(file, offset, read_u64());
+}
+
+size_t binary_reader::read_transaction_count()
+{
+   return static_cast<size_t>(read_u64());
+}
+
+array_view<const transfer> binary_reader::read_transfers()
+{
+   return read_array<transfer>(file, offset, read_u32());
+}
+
+void binary_reader::read_transaction(transaction& t)
+{
+   const array_view<const transfer> transfers = read_transfers();
+   t.assign(transfers.begin(), transfers.end());
+}
+
+uint32_t binary_reader::read_u32()
+{
+   return read_scalar<uint32_t>(file, offset);
+}
+
+uint64_t binary_reader::read_u64()
+{
+   return read_scalar<uint64_t>(file, offset);
+}
+
+binary_writer::binary_writer(const char* path, array_view<const account_balance> accounts, size_t transaction_count):
+   out(create_binary(path, binary_kind::input)), remaining(transaction_count)
+{
+   write_scalar<uint64_t>(out, accounts.size());
+   write_array(out, accounts.begin(), accounts.size());
+   write_scalar<uint64_t>(out, transaction_count);
+}
+
+binary_writer::~binary_writer()
+{
+   if (out) {
+      std::fclose(out);
+   }
+}
+
+void binary_writer::write_transaction(array_view<const transfer> t)
+{
+   if (remaining == 0) {
+      throw std::logic_error("More transactions written than announced.");
+   }
+   --remaining;
+
+   write_scalar<uint32_t>(out, static_cast<uint32_t>(t.size()));
+   write_array(out, t.begin(), t.size());
+}
+
+void binary_writer::close()
+{
+   FILE* file = out;
+   out = nullptr;
+   finish_binary(file, "the binary input");
+   if (remaining != 0) {
+      throw std::logic_error("Fewer transactions written than announced.");
+   }
+}
+
+void write_binary_result(const char* path, const settle_result& result)
+{
+   FILE* out = create_binary(path, binary_kind::result);
+
+   write_scalar<uint64_t>(out, result.applied_transactions.size());
+   if (sizeof(size_t) == sizeof(uint64_t)) {
+      write_array(out, result.applied_transactions.data(), result.applied_transactions.size());
+   } else {
+      for (size_t id : result.applied_transactions) {
+         write_scalar<uint64_t>(out, id);
+      }
+   }
+
+   write_scalar<uint64_t>(out, result.balances.size());
+   write_array(out, result.balances.data(), result.balances.size());
+
+   finish_binary(out, path);
+}
+
+settle_result read_binary_result(const char* path)
+{
+   mapped_file file(path);
+   size_t offset = check_header(file, binary_kind::result, path);
+
+   settle_result result;
+   const array_view<const uint64_t> applied = read_array<uint64_t>(file, offset, read_scalar<uint64_t>(file, offset));
+   result.applied_transactions.assign(applied.begin(), applied.end());
+
+   const array_view<const account_balance> balances = read_array<account_balance>(file, offset, read_scalar<uint64_t>(file, offset));
+   result.balances.assign(balances.begin(), balances.end());
+   return result;
+}
+
+snapshot_reader::snapshot_reader(const char* path): file(path)
+{
+   size_t offset = check_header(file, binary_kind::snapshot, path);
+   next_id = static_cast<size_t>(read_scalar<uint64_t>(file, offset));
+   log_offset = read_scalar<uint64_t>(file, offset);
+   log_checksum = read_scalar<uint32_t>(file, offset);
+   read_scalar<uint32_t>(file, offset);
+   account_records = read_array<account_balance>(file, offset, read_scalar<uint64_t>(file, offset));
+   applied_ids = read_array<uint64_t>(file, offset, read_scalar<uint64_t>(file, offset));
+}
+
+snapshot_writer::snapshot_writer(const char* path, size_t next_transaction, uint64_t wal_offset, uint32_t wal_checksum,
+                                 size_t account_count, size_t applied_count):
+   path(path), temp_path(string(path) + ".tmp"), out(create_binary(temp_path.c_str(), binary_kind::snapshot)),
+   accounts_left(account_count), applied_left(applied_count)
+{
+   write_scalar<uint64_t>(out, next_transaction);
+   write_scalar<uint64_t>(out, wal_offset);
+   write_scalar<uint32_t>(out, wal_checksum);
+   write_scalar<uint32_t>(out, 0);
+   write_scalar<uint64_t>(out, account_count);
+   if (account_count == 0) {
+      write_scalar<uint64_t>(out, applied_count);
+   }
+}
+
+/**
+ * An unfinished snapshot is thrown away, the previous one at path stays.
+ */
+snapshot_writer::~snapshot_writer()
+{
+   if (out) {
+      std::fclose(out);
+      std::remove(temp_path.c_str());
+   }
+}
+
+void snapshot_writer::write_accounts(array_view<const account_balance> accounts)
+{
+   if (accounts.size() > accounts_left) {
+      throw std::logic_error("More accounts written than announced.");
+   }
+   accounts_left -= accounts.size();
+   write_array(out, accounts.begin(), accounts.size());
+
+   // the applied count follows the last account
+   if (!accounts.empty() && accounts_left == 0) {
+      write_scalar<uint64_t>(out, applied_left);
+   }
+}
+
+void snapshot_writer::write_applied(array_view<const uint64_t> ids)
+{
+   if (accounts_left != 0) {
+      throw std::logic_error("Every account has to be written before the applied transactions.");
+   }
+   if (ids.size() > applied_left) {
+      throw std::logic_error("More applied transactions written than announced.");
+   }
+   applied_left -= ids.size();
+   write_array(out, ids.begin(), ids.size());
+}
+
+void snapshot_writer::close()
+{
+   if (accounts_left != 0 || applied_left != 0) {
+      throw std::logic_error("Fewer accounts or applied transactions written than announced.");
+   }
+
+   FILE* file = out;
+   out = nullptr;
+   const bool synced = std::fflush(file) == 0 && ::fsync(fileno(file)) == 0;
+   if (!synced) {
+      std::fclose(file);
+      std::remove(temp_path.c_str());
+      throw std::runtime_error("Could not write " + temp_path + ": " + strerror(errno));
+   }
+   finish_binary(file, temp_path.c_str());
+   if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+      throw std::runtime_error("Could not rename " + temp_path + " to " + path + ": " + strerror(errno));
+   }
+}
+
+/**
+ * Streams one transaction at a time, the input is never held in memory as a whole.
+ */
+void convert_text_to_binary(const char* text_path, const char* binary_path, binary_kind kind)
+{
+   text_reader reader(text_path);
+   if (kind == binary_kind::result) {
+      settle_result result;
+      result.applied_transactions = reader.read_applied_transactions();
+      result.balances = reader.read_accounts();
+      write_binary_result(binary_path, result);
+      return;
+   }
+
+   const vector<account_balance> accounts = reader.read_accounts();
+   size_t remaining_transactions = reader.read_transaction_count();
+   binary_writer writer(binary_path, accounts, remaining_transactions);
+
+   transaction tx;
+   while (remaining_transactions-- > 0) {
+      reader.read_transaction(tx);
+      writer.write_transaction(tx);
+   }
+   writer.close();
+}
+
+/**
+ * Writes the same text that text_reader reads and main() prints to out.txt.
+ */
+void convert_binary_to_text(const char* binary_path, const char* text_path, binary_kind kind)
+{
+   if (kind == binary_kind::input) {
+      binary_reader reader(binary_path);
+      const array_view<const account_balance> accounts = reader.read_accounts();
+      size_t remaining_transactions = reader.read_transaction_count();
+      text_writer writer(text_path, accounts, remaining_transactions);
+
+      while (remaining_transactions-- > 0) {
+         writer.write_transaction(reader.read_transfers());
+      }
+      writer.close();
+      return;
+   }
+
+   const settle_result result = read_binary_result(binary_path);
+   ofstream fout(text_path);
+   if (!fout) {
+      throw std::runtime_error(string("Could not create ") + text_path);
+   }
+
+   fout << result.applied_transactions.size() << '\n';
+   for (size_t cur : result.applied_transactions) {
+      fout << cur << '\n';
+   }
+   fout << result.balances.size() << '\n';
+   for (const auto& cur : result.balances) {
+      fout << cur.account_id << " " << cur.balance << '\n';
+   }
+
+   fout.close();
+   if (!fout) {
+      throw std::runtime_error(string("Could not write ") + text_path);
+   }
+}
@@ -0,0 +1,214 @@
+#ifndef BINARY_FORMAT_HPP
+#define BINARY_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "transaction_db.hpp"
+
+/**
+ * @brief Compact binary counterpart of the text formats. Everything is little-endian.
+ *
+ *        Header (16 bytes):
+ *           char[4]  magic "TXDB"
+ *           uint32   version (binary_version)
+ *           uint32   kind (binary_kind)
+ *           uint32   reserved, always 0
+ *
+ *        Input file (kind input):
+ *           uint64   number of accounts
+ *           { int32 account_id, int32 balance }         (once per account)
+ *           uint64   number of transactions
+ *           uint32   number of transfers                 (once per transaction, followed by its transfers)
+ *           { int32 from, int32 to, int32 amount }       (once per transfer)
+ *
+ *        Result file (kind result):
+ *           uint64   number of applied transactions
+ *           uint64   transaction id                      (once per applied transaction, ascending)
+ *           uint64   number of accounts
+ *           { int32 account_id, int32 balance }         (once per account, ascending by id)
+ *
+ *        Snapshot file (kind snapshot), settled state written by transaction_db::enable_snapshots():
+ *           uint64   next transaction id
+ *           uint64   offset of the last write-ahead log record the snapshot includes, 0 without a log
+ *           uint32   CRC-32C of that record
+ *           uint32   reserved, always 0
+ *           uint64   number of accounts
+ *           { int32 account_id, int32 balance }         (once per account, in dense index order)
+ *           uint64   number of applied transactions
+ *           uint64   transaction id                      (once per applied transaction, ascending)
+ *
+ *        The records are laid out exactly like account_balance and transfer, so arrays are read straight out of the
+ *        mapping and written with a single fwrite instead of field by field. Every field lands on a multiple of its
+ *        own size from the start of the file, so the mapped arrays are properly aligned.
+ */
+constexpr std::uint32_t binary_version = 1;
+
+enum class binary_kind : std::uint32_t { input = 1, result = 2, snapshot = 3 };
+
+/**
+ * @return true if the file starts with the binary magic. Files too short to hold it are text.
+ * @throw std::runtime_error If the file can't be opened.
+ */
+bool is_binary_file(const char* path);
+
+/**
+ * @brief Reads a binary input file out of a memory mapping. Same order as text_reader: read_accounts(),
+ *        read_transaction_count(), then read_transaction() that many times.
+ *        Every read throws std::runtime_error on a truncated file.
+ */
+class binary_reader {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be mapped, or isn't a version 1 input file.
+    */
+   explicit binary_reader(const char* path);
+
+   /**
+    * @return the initial balances. Points into the mapping, only valid while the reader is alive.
+    */
+   array_view<const account_balance> read_accounts();
+
+   /**
+    * @return number of transactions that follow.
+    */
+   size_t read_transaction_count();
+
+   /**
+    * @return the transfers of the next transaction. Points into the mapping, only valid while the reader is alive.
+    */
+   array_view<const transfer> read_transfers();
+
+   /**
+    * @brief Copies the next transaction into t, reusing its capacity like text_reader::read_transaction().
+    */
+   void read_transaction(transaction& t);
+
+private:
+   mapped_file file;
+   size_t offset; ///< next byte to read
+
+   std::uint32_t read_u32();
+   std::uint64_t read_u64();
+};
+
+/**
+ * @brief Writes a binary input file. The transaction count goes in up front, so the transactions can be streamed
+ *        through write_transaction() without holding them all in memory. close() checks that the count was honored.
+ */
+class binary_writer {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be created.
+    */
+   binary_writer(const char* path, array_view<const account_balance> accounts, size_t transaction_count);
+   ~binary_writer();
+
+   binary_writer(const binary_writer&) = delete;
+   binary_writer& operator=(const binary_writer&) = delete;
+
+   void write_transaction(array_view<const transfer> t);
+
+   /**
+    * @brief Flushes and closes the file.
+    * @throw std::runtime_error If a write failed or the wrong number of transactions was written.
+    */
+   void close();
+
+private:
+   std::FILE* out;
+   size_t remaining; ///< transactions still owed
+};
+
+/**
+ * @brief Applied transactions and final balances, what ends up in out.txt.
+ */
+struct settle_result {
+   std::vector<size_t> applied_transactions;
+   std::vector<account_balance> balances;
+};
+
+/**
+ * @brief Writes a result file. Both lists are written in the order given; callers sort them first.
+ * @throw std::runtime_error If the file can't be written.
+ */
+void write_binary_result(const char* path, const settle_result& result);
+
+/**
+ * @throw std::runtime_error If the file can't be mapped, or isn't a well formed version 1 result file.
+ */
+settle_result read_binary_result(const char* path);
+
+/**
+ * @brief Maps a snapshot file. Nothing is copied, the views point into the mapping and stay valid while the reader is
+ *        alive, so opening a snapshot costs the same whatever its size.
+ */
+class snapshot_reader {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be mapped, or isn't a well formed version 1 snapshot file.
+    */
+   explicit snapshot_reader(const char* path);
+
+   size_t next_transaction() const { return next_id; }
+   std::uint64_t wal_offset() const { return log_offset; }
+   std::uint32_t wal_checksum() const { return log_checksum; }
+   array_view<const account_balance> accounts() const { return account_records; }
+   array_view<const std::uint64_t> applied() const { return applied_ids; }
+
+private:
+   mapped_file file;
+   size_t next_id;
+   std::uint64_t log_offset;
+   std::uint32_t log_checksum;
+   array_view<const account_balance> account_records;
+   array_view<const std::uint64_t> applied_ids;
+};
+
+/**
+ * @brief Writes a snapshot file. Both counts go in up front, then the accounts and applied ids are streamed in that
+ *        order, in as many pieces as convenient. Everything goes to PATH.tmp, which close() syncs and renames over path,
+ *        so a crash never leaves a half written snapshot behind.
+ */
+class snapshot_writer {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be created.
+    */
+   snapshot_writer(const char* path, size_t next_transaction, std::uint64_t wal_offset, std::uint32_t wal_checksum,
+                   size_t account_count, size_t applied_count);
+   ~snapshot_writer();
+
+   snapshot_writer(const snapshot_writer&) = delete;
+   snapshot_writer& operator=(const snapshot_writer&) = delete;
+
+   void write_accounts(array_view<const account_balance> accounts);
+   void write_applied(array_view<const std::uint64_t> ids);
+
+   /**
+    * @brief Flushes, syncs and moves the file into place.
+    * @throw std::runtime_error If a write failed.
+    * @throw std::logic_error If the counts given to the constructor weren't honored.
+    */
+   void close();
+
+private:
+   std::string path;
+   std::string temp_path;
+   std::FILE* out;
+   size_t accounts_left; ///< accounts still owed
+   size_t applied_left;  ///< applied ids still owed
+};
+
+/**
+ * @brief Converters between the text and binary formats. kind says whether the files hold an input or a result.
+ * @throw std::runtime_error On malformed input or I/O failure.
+ */
+void convert_text_to_binary(const char* text_path, const char* binary_path, binary_kind kind);
+void convert_binary_to_text(const char* binary_path, const char* text_path, binary_kind kind);
+
+#endif // BINARY_FORMAT_HPP
@@ -0,0 +1,64 @@
+#ifndef CACHE_ALIGNED_HPP
+#define CACHE_ALIGNED_HPP
+
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+
+/**
+ * @brief Bytes in a cache line on the machines this runs on. Types that must not share a line with their neighbours
+ *        are alignas(cache_line), which also rounds their size up to whole lines.
+ */
+constexpr size_t cache_line = 64;
+
+/**
+ * @brief Destroys and frees an array from make_cache_aligned_array().
+ */
+template<typename T>
+struct cache_aligned_delete {
+   size_t count; ///< elements constructed
+
+   void operator()(T* array) const
+   {
+      for (size_t i = count; i > 0; --i) {
+         array[i - 1].~T();
+      }
+      std::free(array);
+   }
+};
+
+template<typename T>
+using cache_aligned_array = std::unique_ptr<T[], cache_aligned_delete<T>>;
+
+/**
+ * @brief new T[count](), only starting on a cache line boundary.
+ *
+ *        Before C++17 new only promises alignof(std::max_align_t), so an array of alignas(cache_line) elements from it
+ *        can start mid-line and every element then straddles two lines.
+ * @throw std::bad_alloc If there is no memory.
+ */
+template<typename T>
+cache_aligned_array<T> make_cache_aligned_array(const size_t count)
+{
+   static_assert(alignof(T) <= cache_line, "T is aligned past a cache line");
+
+   void* memory = nullptr;
+   if (posix_memalign(&memory, cache_line, std::max<size_t>(sizeof(T) * count, 1)) != 0) {
+      throw std::bad_alloc();
+   }
+   T* array = static_cast<T*>(memory);
+   size_t built = 0;
+   try {
+      for (; built < count; ++built) {
+         new (array + built) T();
+      }
+   } catch (...) {
+      cache_aligned_delete<T>{built}(array);
+      throw;
+   }
+   return cache_aligned_array<T>(array, cache_aligned_delete<T>{count});
+}
+
+#endif // CACHE_ALIGNED_HPP
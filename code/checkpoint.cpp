@@ -0,0 +1,106 @@
+#include "checkpoint.hpp"
+
+#include <utility>
+using namespace std;
+
+checkpointer::checkpointer(const std::string& path): path(path), busy(false), stopping(false), completed(0),
+                                                      worker([this]() { run(); })
+{
+}
+
+checkpointer::~checkpointer()
+{
+   {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_all();
+   worker.join();
+}
+
+void checkpointer::submit(std::shared_ptr<const state_view> view)
+{
+   {
+      lock_guard<mutex> guard(lock);
+      rethrow_error();
+      queued = std::move(view);
+   }
+   wake.notify_all();
+}
+
+void checkpointer::wait()
+{
+   unique_lock<mutex> guard(lock);
+   idle.wait(guard, [this]() { return !queued && !busy; });
+   rethrow_error();
+}
+
+std::uint64_t checkpointer::written()
+{
+   lock_guard<mutex> guard(lock);
+   return completed;
+}
+
+/**
+ * The view is written outside the lock, so submit() only ever waits for a pointer swap.
+ * A queued view is still written when stopping, so the newest settled state always reaches the disk.
+ */
+void checkpointer::run()
+{
+   unique_lock<mutex> guard(lock);
+   for (;;) {
+      wake.wait(guard, [this]() { return stopping || queued; });
+      if (!queued) {
+         return;
+      }
+
+      std::shared_ptr<const state_view> view = std::move(queued);
+      queued = nullptr;
+      busy = true;
+      guard.unlock();
+
+      std::exception_ptr failure;
+      try {
+         write_snapshot(path.c_str(), *view);
+      } catch (...) {
+         failure = std::current_exception();
+      }
+      view = nullptr; // pages no newer view shares are freed here, not on the settle thread
+
+      guard.lock();
+      busy = false;
+      if (failure) {
+         error = error ? error : failure;
+      } else {
+         ++completed;
+      }
+      idle.notify_all();
+   }
+}
+
+/**
+ * Only called with lock held.
+ */
+void checkpointer::rethrow_error()
+{
+   if (error) {
+      std::exception_ptr e = error;
+      error = nullptr;
+      std::rethrow_exception(e);
+   }
+}
+
+void write_snapshot(const char* path, const state_view& view)
+{
+   snapshot_writer out(path, view.next_transaction, view.wal_offset, view.wal_checksum, view.account_count, view.applied_count());
+   for (const auto& p: view.pages) {
+      out.write_accounts(*p);
+   }
+   if (view.base) {
+      out.write_applied(view.base->applied());
+   }
+   for (const auto& s: view.applied) {
+      out.write_applied(*s);
+   }
+   out.close();
+}
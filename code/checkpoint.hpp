@@ -0,0 +1,70 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <condition_variable>
+
+#include "state_view.hpp"
+
+/**
+ * @brief Writes snapshots on a background thread. submit() only queues a view, so settle never waits on the disk.
+ *        If views come in faster than they can be written, the ones waiting are replaced by the newest.
+ */
+class checkpointer {
+public:
+   explicit checkpointer(const std::string& path);
+
+   /**
+    * @brief Finishes the queued snapshot, if any, then stops the thread.
+    */
+   ~checkpointer();
+
+   checkpointer(const checkpointer&) = delete;
+   checkpointer& operator=(const checkpointer&) = delete;
+
+   /**
+    * @brief Queues view to be written, replacing a queued view that hasn't started yet.
+    * @throw std::runtime_error The error a previous snapshot failed with, if it hasn't been reported yet.
+    */
+   void submit(std::shared_ptr<const state_view> view);
+
+   /**
+    * @brief Blocks until nothing is queued or being written.
+    * @throw std::runtime_error The error a previous snapshot failed with, if it hasn't been reported yet.
+    */
+   void wait();
+
+   /**
+    * @return snapshots written so far.
+    */
+   std::uint64_t written();
+
+private:
+   const std::string path;
+   std::mutex lock;
+   std::condition_variable wake; ///< signaled when a view is queued or the thread should stop
+   std::condition_variable idle; ///< signaled when a snapshot is done
+   std::shared_ptr<const state_view> queued; ///< next view to write, nullptr if none
+   bool busy;                    ///< a snapshot is being written
+   bool stopping;
+   std::exception_ptr error;     ///< first failure not reported yet
+   std::uint64_t completed;
+   std::thread worker;           ///< last, so everything above is set up before it starts
+
+   void run();
+   void rethrow_error();
+};
+
+/**
+ * @brief Writes view to path through snapshot_writer. Runs on the checkpointer thread, also usable directly.
+ */
+void write_snapshot(const char* path, const state_view& view);
+
+#endif // CHECKPOINT_HPP
@@ -0,0 +1,24 @@
+#include "concurrent_ingest.hpp"
+
+#include <thread>
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+constexpr size_t ingest_state::stripe_count;
+
+ingest_state::ingest_state(const size_t first_id, const size_t account_count, const size_t producer_shards):
+                           first_id(first_id), next_id(first_id), rejected(0), transfers(0), seen(account_count, 0),
+                           shard_count(std::max<size_t>(producer_shards, 1)),
+                           shards(make_cache_aligned_array<ingest_shard>(shard_count)),
+                           stripes(make_cache_aligned_array<account_stripe>(stripe_count))
+{
+}
+
+/**
+ * Same spread as epoch_domain::pin(): a thread always lands on the same shard, different threads rarely share one.
+ */
+ingest_shard& ingest_state::shard_for_this_thread()
+{
+   return shards[std::hash<std::thread::id>()(std::this_thread::get_id()) % shard_count];
+}
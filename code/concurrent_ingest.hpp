@@ -0,0 +1,70 @@
+#ifndef CONCURRENT_INGEST_HPP
+#define CONCURRENT_INGEST_HPP
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "cache_aligned.hpp"
+#include "transaction_db.hpp"
+
+/**
+ * @brief Where one group of producers builds transaction logs. Producers are spread over the shards by thread id, so
+ *        two of them only wait for each other when they land on the same shard. Starts on a cache line of its own, so
+ *        neighbouring shards' locks don't bounce each other's lines.
+ */
+struct alignas(cache_line) ingest_shard {
+   std::mutex lock;
+   log_arena arena;                     ///< memory of the logs built here, handed to the database's arena by end_ingest()
+   std::vector<transaction_log*> logs;  ///< in the order they were built, not by id
+};
+
+/**
+ * @brief Owns every account whose dense index is congruent to it modulo the stripe count: its balance, its
+ *        pending_by_account list, and its entry in touched while an ingest is open.
+ */
+struct alignas(cache_line) account_stripe {
+   std::mutex lock;
+   std::vector<size_t> touched; ///< accounts of this stripe changed since begin_ingest(), each once
+};
+
+/**
+ * @brief Everything transaction_db::ingest_transaction() shares between producer threads. Lives from begin_ingest()
+ *        to end_ingest().
+ *
+ *        Ids are tickets from one atomic counter, taken once a transaction passed validation, so accepted transactions
+ *        get the same dense ids they would have pushed one by one. The order logs were built in and the order
+ *        ids were appended to each pending_by_account list are only put back into id order by end_ingest().
+ */
+struct ingest_state {
+   ingest_state(const size_t first_id, const size_t account_count, const size_t producer_shards);
+
+   ingest_state(const ingest_state&) = delete;
+   ingest_state& operator=(const ingest_state&) = delete;
+
+   /**
+    * @return the shard producers on the calling thread use.
+    */
+   ingest_shard& shard_for_this_thread();
+
+   /**
+    * @return the stripe owning account.
+    */
+   account_stripe& stripe_of(const size_t account) { return stripes[account % stripe_count]; }
+
+   static constexpr size_t stripe_count = 256;
+
+   const size_t first_id;                 ///< current_transaction when the ingest began
+   std::atomic<size_t> next_id;           ///< next ticket
+   std::atomic<std::uint64_t> rejected;   ///< transactions the validation policy turned away
+   std::atomic<std::uint64_t> transfers;  ///< transfers of accepted transactions
+   std::vector<char> seen;                ///< per account, whether it is in its stripe's touched list. Written under the stripe lock
+   const size_t shard_count;
+   cache_aligned_array<ingest_shard> shards;
+   cache_aligned_array<account_stripe> stripes;
+};
+
+#endif // CONCURRENT_INGEST_HPP
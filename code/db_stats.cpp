@@ -0,0 +1,95 @@
+#include "db_stats.hpp"
+
+#include <sstream>
+using namespace std;
+
+constexpr size_t stats_histogram::bucket_count;
+
+string stats_histogram::to_json() const
+{
+   ostringstream out;
+   out << "{\"count\":" << samples << ",\"sum\":" << total << ",\"min\":" << smallest << ",\"max\":" << largest << ",\"buckets\":{";
+
+   // keyed by the bucket's exclusive upper bound, 2^64 is written out since it doesn't fit in a uint64_t
+   bool first = true;
+   for (size_t i = 0; i < bucket_count; ++i) {
+      if (buckets[i] == 0) {
+         continue;
+      }
+      out << (first ? "" : ",") << '"';
+      if (i == 64) {
+         out << "18446744073709551616";
+      } else {
+         out << (std::uint64_t(1) << i);
+      }
+      out << "\":" << buckets[i];
+      first = false;
+   }
+   out << "}}";
+   return out.str();
+}
+
+static void settle_to_json(ostringstream& out, const settle_stats& s)
+{
+   out << "{\"rounds\":" << s.rounds
+       << ",\"candidates_scored\":" << s.candidates_scored
+       << ",\"exact_fallbacks\":" << s.exact_fallbacks
+       << ",\"accounts_touched\":" << s.accounts_touched
+       << ",\"rollbacks\":" << s.rollbacks
+       << ",\"accepted\":" << s.accepted
+       << ",\"wall_ns\":" << s.wall_ns << "}";
+}
+
+void transaction_db_stats::record_settle(const settle_stats& s)
+{
+   ++settles;
+   totals.rounds += s.rounds;
+   totals.candidates_scored += s.candidates_scored;
+   totals.exact_fallbacks += s.exact_fallbacks;
+   totals.accounts_touched += s.accounts_touched;
+   totals.rollbacks += s.rollbacks;
+   totals.accepted += s.accepted;
+   totals.wall_ns += s.wall_ns;
+   last_settle = s;
+
+   const std::uint64_t pending = s.accepted + s.rollbacks;
+   settle_wall_us.record(s.wall_ns / 1000);
+   settle_rounds.record(s.rounds);
+   settle_candidates.record(s.candidates_scored);
+   settle_dropped_permille.record(pending == 0 ? 0 : s.rollbacks * 1000 / pending);
+}
+
+string transaction_db_stats::to_json() const
+{
+   ostringstream out;
+   out << "{\"push\":{\"validated_transfers\":" << validated_transfers
+       << ",\"accepted_transactions\":" << accepted_transactions
+       << ",\"rejected_transactions\":" << rejected_transactions << "}";
+
+   out << ",\"settle\":{\"settles\":" << settles << ",\"totals\":";
+   settle_to_json(out, totals);
+   out << ",\"last\":";
+   settle_to_json(out, last_settle);
+   out << ",\"wall_us\":" << settle_wall_us.to_json()
+       << ",\"rounds\":" << settle_rounds.to_json()
+       << ",\"candidates_scored\":" << settle_candidates.to_json()
+       << ",\"dropped_permille\":" << settle_dropped_permille.to_json() << "}}";
+   return out.str();
+}
+
+string ingest_queue_stats::to_json() const
+{
+   ostringstream out;
+   out << "{\"enqueued\":" << enqueued
+       << ",\"applied\":" << applied
+       << ",\"rejected\":" << rejected
+       << ",\"batches\":" << batches
+       << ",\"full_waits\":" << full_waits
+       << ",\"full_fails\":" << full_fails
+       << ",\"depth\":" << depth
+       << ",\"max_depth\":" << max_depth
+       << ",\"capacity\":" << capacity
+       << ",\"batch_depth\":" << batch_depth.to_json()
+       << ",\"batch_size\":" << batch_size.to_json() << "}";
+   return out.str();
+}
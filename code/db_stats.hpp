@@ -0,0 +1,114 @@
+#ifndef DB_STATS_HPP
+#define DB_STATS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Histogram with power of two buckets. Bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i).
+ *        Recording is a couple of adds and a count-leading-zeros, cheap enough for every settle.
+ */
+class stats_histogram {
+public:
+   static constexpr size_t bucket_count = 65;
+
+   void record(const std::uint64_t value)
+   {
+      const size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+      ++buckets[bucket];
+      ++samples;
+      total += value;
+      smallest = (samples == 1 || value < smallest) ? value : smallest;
+      largest = value > largest ? value : largest;
+   }
+
+   std::uint64_t count() const { return samples; }
+   std::uint64_t sum() const { return total; }
+   std::uint64_t min() const { return smallest; }
+   std::uint64_t max() const { return largest; }
+   std::uint64_t bucket(const size_t i) const { return buckets[i]; }
+
+   /**
+    * @return {"count":..,"sum":..,"min":..,"max":..,"buckets":{"<upper bound>":count,..}}, empty buckets left out.
+    */
+   std::string to_json() const;
+
+private:
+   std::uint64_t buckets[bucket_count] = {};
+   std::uint64_t samples = 0;
+   std::uint64_t total = 0;
+   std::uint64_t smallest = 0;
+   std::uint64_t largest = 0;
+};
+
+/**
+ * @brief Counters for a single settle().
+ */
+struct settle_stats {
+   std::uint64_t rounds = 0;            ///< greedy: transactions rolled back one per round. branch and bound: search nodes visited
+   std::uint64_t candidates_scored = 0; ///< greedy: simulated rollbacks. branch and bound: transactions handed to the search
+   std::uint64_t exact_fallbacks = 0;   ///< branch and bound: scopes whose search ran out of nodes and were settled greedily
+   std::uint64_t accounts_touched = 0;  ///< accounts changed by at least one pending transaction
+   std::uint64_t rollbacks = 0;         ///< transactions dropped
+   std::uint64_t accepted = 0;          ///< transactions committed
+   std::uint64_t wall_ns = 0;           ///< time spent in settle()
+};
+
+/**
+ * @brief What transaction_db has done since it was built or since reset_stats(). Only plain counters are touched on the
+ *        hot paths, so it is always on.
+ */
+struct transaction_db_stats {
+   // push side
+   std::uint64_t validated_transfers = 0;   ///< transfers of accepted transactions, every one passed validation
+   std::uint64_t accepted_transactions = 0; ///< transactions pushed and applied
+   std::uint64_t rejected_transactions = 0; ///< transactions the validation policy turned away
+
+   // settle side, summed over every settle
+   std::uint64_t settles = 0;
+   settle_stats totals;
+   settle_stats last_settle;
+
+   // one sample per settle
+   stats_histogram settle_wall_us;          ///< wall time in microseconds
+   stats_histogram settle_rounds;
+   stats_histogram settle_candidates;
+   stats_histogram settle_dropped_permille; ///< rollbacks per thousand pending transactions
+
+   /**
+    * @brief Adds a finished settle to the totals and histograms.
+    */
+   void record_settle(const settle_stats& s);
+
+   /**
+    * @return every counter and histogram as a JSON object.
+    */
+   std::string to_json() const;
+};
+
+/**
+ * @brief What an ingest_queue has done since it started. Producer side counters come from the ring's own positions,
+ *        apply side ones are updated once per batch, so keeping them costs the hot path nothing.
+ */
+struct ingest_queue_stats {
+   std::uint64_t enqueued = 0;   ///< transactions producers put in the ring
+   std::uint64_t applied = 0;    ///< transactions handed to the database, accepted or not
+   std::uint64_t rejected = 0;   ///< transactions the validation policy turned away
+   std::uint64_t batches = 0;
+   std::uint64_t full_waits = 0; ///< push() calls that found the ring full and waited for room
+   std::uint64_t full_fails = 0; ///< try_push() calls turned away because the ring was full
+   std::uint64_t depth = 0;      ///< transactions in the ring when the stats were taken
+   std::uint64_t max_depth = 0;  ///< most transactions ever seen waiting at the start of a batch
+   std::uint64_t capacity = 0;
+
+   stats_histogram batch_depth;  ///< transactions waiting at the start of each batch
+   stats_histogram batch_size;   ///< transactions applied per batch
+
+   /**
+    * @return every counter and histogram as a JSON object.
+    */
+   std::string to_json() const;
+};
+
+#endif // DB_STATS_HPP
@@ -0,0 +1,63 @@
+#include "epoch_domain.hpp"
+
+#include <thread>
+#include <limits>
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+epoch_domain::epoch_domain(const size_t max_readers): slot_count(std::max<size_t>(max_readers, 1)),
+                                                       slots(make_cache_aligned_array<reader_slot>(slot_count)), global_epoch(1)
+{
+   for (size_t i = 0; i < slot_count; ++i) {
+      slots[i].epoch.store(0);
+   }
+}
+
+/**
+ * Each thread starts looking at a slot picked from its id, so readers on different threads rarely try the same one.
+ * The epoch may be bumped between loading it and claiming the slot. That only makes the pin older than it has to be,
+ * which keeps more objects alive, never fewer.
+ */
+size_t epoch_domain::pin()
+{
+   const size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % slot_count;
+   for (;;) {
+      const uint64_t now = global_epoch.load();
+      for (size_t i = 0; i < slot_count; ++i) {
+         const size_t slot = (start + i) % slot_count;
+         uint64_t expected = 0;
+         if (slots[slot].epoch.compare_exchange_strong(expected, now)) {
+            return slot;
+         }
+      }
+      std::this_thread::yield();
+   }
+}
+
+void epoch_domain::unpin(const size_t slot)
+{
+   slots[slot].epoch.store(0);
+}
+
+void epoch_domain::retire(std::shared_ptr<const void> object)
+{
+   if (object) {
+      limbo.emplace_back(global_epoch.fetch_add(1), std::move(object));
+   }
+}
+
+void epoch_domain::collect()
+{
+   uint64_t oldest = std::numeric_limits<uint64_t>::max();
+   for (size_t i = 0; i < slot_count; ++i) {
+      const uint64_t pinned = slots[i].epoch.load();
+      if (pinned != 0) {
+         oldest = std::min(oldest, pinned);
+      }
+   }
+
+   // limbo is in retire order, so the freeable objects are a prefix
+   auto first_kept = std::find_if(limbo.begin(), limbo.end(), [oldest](const auto& x) { return x.first >= oldest; });
+   limbo.erase(limbo.begin(), first_kept);
+}
@@ -0,0 +1,73 @@
+#ifndef EPOCH_DOMAIN_HPP
+#define EPOCH_DOMAIN_HPP
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "cache_aligned.hpp"
+
+/**
+ * @brief Epoch-based reclamation for objects one writer replaces while any number of readers look at them.
+ *
+ *        A reader pins the current epoch in a slot of its own before it loads a shared pointer, and clears the slot
+ *        when it is done. The writer swaps the pointer, then retires the old object under the epoch it bumps past.
+ *        An object is freed once every pinned slot holds a later epoch, since readers pinned that late can only have
+ *        loaded the new pointer. Readers never write anything another reader touches, and never wait on the writer.
+ *
+ *        Every atomic operation is sequentially consistent. The argument above relies on the reader's slot store and
+ *        pointer load, and the writer's pointer store, epoch bump and slot scan, all falling into one total order.
+ */
+class epoch_domain {
+public:
+   /**
+    * @param max_readers Readers that can be pinned at once. pin() yields until a slot frees up past that.
+    */
+   explicit epoch_domain(const size_t max_readers);
+
+   epoch_domain(const epoch_domain&) = delete;
+   epoch_domain& operator=(const epoch_domain&) = delete;
+
+   /**
+    * @brief Claims a slot and pins the current epoch in it. Any thread.
+    * @return the slot, to be handed back to unpin().
+    */
+   size_t pin();
+
+   /**
+    * @brief Releases a slot from pin(). Any thread.
+    */
+   void unpin(const size_t slot);
+
+   /**
+    * @brief Frees object once no reader can still see it. Call after the pointer readers load no longer leads to it.
+    *        Writer only.
+    */
+   void retire(std::shared_ptr<const void> object);
+
+   /**
+    * @brief Frees every retired object older than the oldest pinned epoch. Writer only.
+    */
+   void collect();
+
+   /**
+    * @return retired objects not freed yet. Writer only.
+    */
+   size_t pending() const { return limbo.size(); }
+
+private:
+   // one slot per cache line, so readers pinning at the same time don't bounce each other's lines
+   struct alignas(cache_line) reader_slot {
+      std::atomic<std::uint64_t> epoch; ///< pinned epoch, 0 while the slot is free
+   };
+
+   const size_t slot_count;
+   cache_aligned_array<reader_slot> slots;
+   std::atomic<std::uint64_t> global_epoch; ///< starts at 1, so 0 can mean free
+   std::vector<std::pair<std::uint64_t, std::shared_ptr<const void>>> limbo; ///< (epoch retired under, object), oldest first
+};
+
+#endif // EPOCH_DOMAIN_HPP
@@ -0,0 +1,212 @@
+#ifndef INDEXED_HEAP_HPP
+#define INDEXED_HEAP_HPP
+
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+/**
+ * @brief Binary min-heap where every key is filed under a handle, so it can be found again to change or remove it.
+ *
+ *        Where each handle sits is kept in a vector the caller owns, indexed by handle. Heaps over disjoint handles
+ *        can share one, even from different threads, and finding a handle is one load instead of a hash lookup.
+ *        The slot of every handle not in a heap holds npos, and the destructor leaves the slots like that again.
+ *        Key needs operator<.
+ */
+template<typename Key>
+class indexed_heap {
+public:
+   static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+   /**
+    * @param slot_of Slot of every handle used with this heap, npos for all of them.
+    */
+   explicit indexed_heap(std::vector<size_t>& slot_of): slot_of(slot_of) {}
+
+   ~indexed_heap() { clear(); }
+
+   indexed_heap(const indexed_heap&) = delete;
+   indexed_heap& operator=(const indexed_heap&) = delete;
+
+   bool empty() const { return items.empty(); }
+   size_t size() const { return items.size(); }
+
+   /**
+    * @return smallest key. The heap must not be empty.
+    */
+   const Key& top() const { return items.front().first; }
+
+   bool contains(const size_t handle) const { return slot_of[handle] != npos; }
+
+   /**
+    * @brief Files key under handle, or replaces the key handle already has. O(log n).
+    */
+   void set(const size_t handle, const Key& key);
+
+   /**
+    * @brief Takes handle out, if it is in. O(log n).
+    */
+   void erase(const size_t handle);
+
+   /**
+    * @brief Adds a handle that isn't in the heap without ordering it. build() has to run before anything else is called.
+    */
+   void push_unordered(const size_t handle, const Key& key);
+
+   /**
+    * @brief Orders everything added by push_unordered(). O(n).
+    */
+   void build();
+
+   /**
+    * @brief Calls rekey(handle, key) for every handle, where rekey may change key and returns false to take the handle
+    *        out. Reorders once at the end, O(n) plus the calls, cheaper than set() once most keys change.
+    */
+   template<typename Rekey>
+   void rekey_all(Rekey rekey);
+
+   void clear();
+
+private:
+   std::vector<size_t>& slot_of;
+   std::vector<std::pair<Key, size_t>> items; ///< (key, handle), heap ordered by key
+
+   void sift_up(size_t pos);
+   void sift_down(size_t pos);
+
+   void place(const size_t pos, std::pair<Key, size_t>&& item) {
+      slot_of[item.second] = pos;
+      items[pos] = std::move(item);
+   }
+};
+
+template<typename Key>
+constexpr size_t indexed_heap<Key>::npos;
+
+template<typename Key>
+void indexed_heap<Key>::set(const size_t handle, const Key& key)
+{
+   const size_t pos = slot_of[handle];
+   if (pos == npos) {
+      slot_of[handle] = items.size();
+      items.emplace_back(key, handle);
+      sift_up(items.size() - 1);
+   } else if (key < items[pos].first) {
+      items[pos].first = key;
+      sift_up(pos);
+   } else {
+      items[pos].first = key;
+      sift_down(pos);
+   }
+}
+
+/**
+ * The last item takes the hole and moves whichever way it has to.
+ */
+template<typename Key>
+void indexed_heap<Key>::erase(const size_t handle)
+{
+   const size_t pos = slot_of[handle];
+   if (pos == npos) {
+      return;
+   }
+   slot_of[handle] = npos;
+
+   std::pair<Key, size_t> last = std::move(items.back());
+   items.pop_back();
+   if (pos == items.size()) {
+      return;
+   }
+   const bool up = pos > 0 && last.first < items[(pos - 1) / 2].first;
+   place(pos, std::move(last));
+   if (up) {
+      sift_up(pos);
+   } else {
+      sift_down(pos);
+   }
+}
+
+template<typename Key>
+void indexed_heap<Key>::push_unordered(const size_t handle, const Key& key)
+{
+   slot_of[handle] = items.size();
+   items.emplace_back(key, handle);
+}
+
+/**
+ * Floyd's bottom-up construction, every parent sifted down once.
+ */
+template<typename Key>
+void indexed_heap<Key>::build()
+{
+   for (size_t pos = items.size() / 2; pos-- > 0;) {
+      sift_down(pos);
+   }
+}
+
+template<typename Key>
+template<typename Rekey>
+void indexed_heap<Key>::rekey_all(Rekey rekey)
+{
+   size_t kept = 0;
+   for (size_t pos = 0; pos < items.size(); ++pos) {
+      if (rekey(items[pos].second, items[pos].first)) {
+         place(kept++, std::move(items[pos]));
+      } else {
+         slot_of[items[pos].second] = npos;
+      }
+   }
+   items.resize(kept);
+   build();
+}
+
+template<typename Key>
+void indexed_heap<Key>::clear()
+{
+   for (const auto& item: items) {
+      slot_of[item.second] = npos;
+   }
+   items.clear();
+}
+
+/**
+ * Moves the item up into a hole instead of swapping at every level.
+ */
+template<typename Key>
+void indexed_heap<Key>::sift_up(size_t pos)
+{
+   std::pair<Key, size_t> item = std::move(items[pos]);
+   while (pos > 0) {
+      const size_t parent = (pos - 1) / 2;
+      if (!(item.first < items[parent].first)) {
+         break;
+      }
+      place(pos, std::move(items[parent]));
+      pos = parent;
+   }
+   place(pos, std::move(item));
+}
+
+template<typename Key>
+void indexed_heap<Key>::sift_down(size_t pos)
+{
+   std::pair<Key, size_t> item = std::move(items[pos]);
+   for (;;) {
+      size_t child = 2 * pos + 1;
+      if (child >= items.size()) {
+         break;
+      }
+      if (child + 1 < items.size() && items[child + 1].first < items[child].first) {
+         ++child;
+      }
+      if (!(items[child].first < item.first)) {
+         break;
+      }
+      place(pos, std::move(items[child]));
+      pos = child;
+   }
+   place(pos, std::move(item));
+}
+
+#endif // INDEXED_HEAP_HPP
@@ -0,0 +1,292 @@
+#include "ingest_queue.hpp"
+
+#include <algorithm>
+#include <utility>
+using namespace std;
+
+constexpr size_t ingest_queue::default_capacity;
+constexpr size_t ingest_queue::default_max_batch;
+
+static size_t round_up_to_power_of_two(const size_t n)
+{
+   size_t power = 1;
+   while (power < n) {
+      power *= 2;
+   }
+   return power;
+}
+
+/**
+ * Slot i starts out free for position i.
+ */
+cache_aligned_array<ingest_queue::slot> ingest_queue::make_ring(const size_t slot_count)
+{
+   cache_aligned_array<slot> ring = make_cache_aligned_array<slot>(slot_count);
+   for (size_t i = 0; i < slot_count; ++i) {
+      ring[i].sequence.store(i);
+   }
+   return ring;
+}
+
+ingest_queue::ingest_queue(transaction_db& db, const size_t capacity, const size_t max_batch, apply_batch apply):
+                           db(db), slot_count(round_up_to_power_of_two(std::max<size_t>(capacity, 2))), mask(slot_count - 1),
+                           max_batch(std::max<size_t>(max_batch, 1)), apply(apply), ring(make_ring(slot_count)), tail(0), head(0),
+                           consumer_sleeping(false), producers_waiting(0), full_waits(0), full_fails(0), stopping(false),
+                           request_pending(false), request_settle(false), request_target(0), batch(this->max_batch),
+                           worker([this]() { run(); })
+{
+}
+
+ingest_queue::~ingest_queue()
+{
+   {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_all();
+   worker.join();
+}
+
+/**
+ * A slot is free for position when its sequence equals position. Seeing an older sequence means the apply thread
+ * hasn't taken what was put there one lap ago, so the ring is full. Seeing a newer one means another producer claimed
+ * position first, and the tail is reloaded.
+ *
+ * The sequence store and the consumer_sleeping load are sequentially consistent, like the apply thread's store of
+ * consumer_sleeping and its load of the sequence before it waits: either it sees the filled slot, or this sees it asleep.
+ */
+bool ingest_queue::enqueue(const transaction& t)
+{
+   size_t position = tail.load(std::memory_order_relaxed);
+   slot* s = nullptr;
+   for (;;) {
+      s = &ring[position & mask];
+      const size_t sequence = s->sequence.load(std::memory_order_acquire);
+      const std::ptrdiff_t lag = static_cast<std::ptrdiff_t>(sequence - position);
+      if (lag == 0) {
+         if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            break;
+         }
+      } else if (lag < 0) {
+         return false;
+      } else {
+         position = tail.load(std::memory_order_relaxed);
+      }
+   }
+
+   s->value.assign(t.begin(), t.end());
+   s->sequence.store(position + 1);
+   if (consumer_sleeping.load()) {
+      lock_guard<mutex> guard(lock);
+      wake.notify_one();
+   }
+   return true;
+}
+
+bool ingest_queue::try_push(const transaction& t)
+{
+   if (enqueue(t)) {
+      return true;
+   }
+   full_fails.fetch_add(1, std::memory_order_relaxed);
+   return false;
+}
+
+/**
+ * Yields a few times first, the apply thread usually frees a whole batch of slots at once. Only then it sleeps on room.
+ */
+void ingest_queue::push(const transaction& t)
+{
+   if (enqueue(t)) {
+      return;
+   }
+   full_waits.fetch_add(1, std::memory_order_relaxed);
+
+   for (int spin = 0; spin < 16; ++spin) {
+      std::this_thread::yield();
+      if (enqueue(t)) {
+         return;
+      }
+   }
+
+   for (;;) {
+      {
+         unique_lock<mutex> guard(lock);
+         producers_waiting.fetch_add(1);
+         room.wait(guard, [this]() { return has_room(); });
+         producers_waiting.fetch_sub(1);
+      }
+      if (enqueue(t)) {
+         return;
+      }
+      // another producer took the room first
+   }
+}
+
+void ingest_queue::drain()
+{
+   request(false);
+}
+
+void ingest_queue::settle()
+{
+   request(true);
+}
+
+size_t ingest_queue::depth() const
+{
+   const size_t taken = head.load();
+   const size_t claimed = tail.load();
+   return claimed > taken ? claimed - taken : 0;
+}
+
+ingest_queue_stats ingest_queue::get_stats() const
+{
+   ingest_queue_stats copy;
+   {
+      lock_guard<mutex> guard(stats_lock);
+      copy = stats;
+   }
+   copy.enqueued = tail.load();
+   copy.full_waits = full_waits.load();
+   copy.full_fails = full_fails.load();
+   copy.depth = depth();
+   copy.capacity = slot_count;
+   return copy;
+}
+
+bool ingest_queue::ready(const size_t position) const
+{
+   return ring[position & mask].sequence.load() == position + 1;
+}
+
+bool ingest_queue::has_room() const
+{
+   const size_t position = tail.load();
+   return static_cast<std::ptrdiff_t>(ring[position & mask].sequence.load() - position) >= 0;
+}
+
+/**
+ * Apply thread only. Each slot is handed back as soon as its transaction is swapped out, before the batch is applied.
+ */
+size_t ingest_queue::take()
+{
+   size_t position = head.load(std::memory_order_relaxed);
+   size_t taken = 0;
+   while (taken < max_batch && ready(position)) {
+      slot& s = ring[position & mask];
+      batch[taken++].swap(s.value);
+      s.sequence.store(position + slot_count);
+      ++position;
+   }
+   head.store(position);
+   return taken;
+}
+
+/**
+ * A request is served as soon as the head passes the tail it saw, even if producers keep the ring from ever running
+ * empty. Failures are kept for the next drain() or settle(), the thread carries on with the next batch.
+ */
+void ingest_queue::run()
+{
+   int idle_spins = 0;
+   for (;;) {
+      if (request_pending) {
+         unique_lock<mutex> guard(lock);
+         if (request_pending && head.load() >= request_target) {
+            if (request_settle) {
+               guard.unlock();
+               std::exception_ptr failure;
+               try {
+                  db.settle();
+               } catch (...) {
+                  failure = std::current_exception();
+               }
+               guard.lock();
+               error = error ? error : failure;
+            }
+            request_pending = false;
+            done.notify_all();
+            continue;
+         }
+      }
+
+      const size_t waiting = depth();
+      const size_t taken = take();
+      if (taken > 0) {
+         idle_spins = 0;
+         // the slots are free again already, producers waiting on room can fill them while the batch is applied
+         if (producers_waiting.load() > 0) {
+            lock_guard<mutex> guard(lock);
+            room.notify_all();
+         }
+
+         std::exception_ptr failure;
+         size_t rejected = 0;
+         try {
+            const auto status = apply(db, array_view<const transaction>(batch.data(), taken));
+            rejected = std::count(status.begin(), status.end(), push_status::invalid_account);
+         } catch (...) {
+            failure = std::current_exception();
+         }
+
+         {
+            lock_guard<mutex> guard(stats_lock);
+            ++stats.batches;
+            stats.applied += taken;
+            stats.rejected += rejected;
+            stats.max_depth = std::max<std::uint64_t>(stats.max_depth, waiting);
+            stats.batch_depth.record(waiting);
+            stats.batch_size.record(taken);
+         }
+         if (failure) {
+            lock_guard<mutex> guard(lock);
+            error = error ? error : failure;
+         }
+         continue;
+      }
+
+      // a producer is usually halfway through filling the next slot, waking up costs more than a few yields
+      if (idle_spins < 16) {
+         ++idle_spins;
+         std::this_thread::yield();
+         continue;
+      }
+      idle_spins = 0;
+
+      unique_lock<mutex> guard(lock);
+      if (stopping && head.load() == tail.load()) {
+         return;
+      }
+      consumer_sleeping.store(true);
+      wake.wait(guard, [this]() {
+         const size_t position = head.load();
+         return ready(position) || (stopping && position == tail.load()) || (request_pending && position >= request_target);
+      });
+      consumer_sleeping.store(false);
+   }
+}
+
+void ingest_queue::request(const bool settle)
+{
+   lock_guard<mutex> one_at_a_time(request_lock);
+   unique_lock<mutex> guard(lock);
+   request_target = tail.load();
+   request_settle = settle;
+   request_pending = true;
+   wake.notify_all();
+   done.wait(guard, [this]() { return !request_pending; });
+   rethrow_error();
+}
+
+/**
+ * Only called with lock held.
+ */
+void ingest_queue::rethrow_error()
+{
+   if (error) {
+      std::exception_ptr e = error;
+      error = nullptr;
+      std::rethrow_exception(e);
+   }
+}
@@ -0,0 +1,153 @@
+#ifndef INGEST_QUEUE_HPP
+#define INGEST_QUEUE_HPP
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <condition_variable>
+
+#include "db_stats.hpp"
+#include "cache_aligned.hpp"
+#include "transaction_db.hpp"
+
+/**
+ * @brief Applies a batch with transaction_db::push_transactions<Validator>. What ingest_queue calls by default.
+ */
+template<typename Validator = accounts_must_exist>
+std::vector<push_status> push_batch(transaction_db& db, array_view<const transaction> batch)
+{
+   return db.push_transactions<Validator>(batch);
+}
+
+/**
+ * @brief Front end where any number of producer threads hand transactions to one apply thread, which owns the database.
+ *
+ *        Producers copy a transaction into a bounded ring and return. The ring is lock-free: every slot carries a
+ *        sequence number saying whose turn it is, producers claim a slot with one compare-and-swap on the tail and
+ *        publish it by bumping the slot's sequence. The apply thread takes up to max_batch ready slots at a time and
+ *        pushes them with push_transactions(), so validation, folding and applying all happen on one thread, in the
+ *        order the slots were claimed. Taking a slot swaps its buffer with one of the batch's, so in steady state
+ *        neither side allocates.
+ *
+ *        When the ring is full, try_push() fails and push() waits for the apply thread to make room. Either thread
+ *        only touches a lock to wake the other up when it is actually asleep.
+ *
+ *        While the queue runs, the database belongs to the apply thread. Other threads go through settle() and
+ *        drain(), or read published versions with read_balances(). Producers don't learn whether a transaction was
+ *        accepted, only get_stats() counts the rejected ones.
+ */
+class ingest_queue {
+public:
+   using apply_batch = std::vector<push_status> (*)(transaction_db& db, array_view<const transaction> batch);
+
+   static constexpr size_t default_capacity = 4096;
+   static constexpr size_t default_max_batch = 256;
+
+   /**
+    * @param capacity Transactions the ring holds, rounded up to a power of two.
+    * @param max_batch Most transactions applied in one push_transactions() call.
+    * @param apply How a batch is applied, push_batch<Validator> picks the validation policy.
+    */
+   explicit ingest_queue(transaction_db& db, const size_t capacity = default_capacity,
+                         const size_t max_batch = default_max_batch, apply_batch apply = &push_batch<>);
+
+   /**
+    * @brief Applies everything still in the ring, then stops the apply thread. No producer may push from here on.
+    */
+   ~ingest_queue();
+
+   ingest_queue(const ingest_queue&) = delete;
+   ingest_queue& operator=(const ingest_queue&) = delete;
+
+   /**
+    * @brief Copies t into the ring. Any thread.
+    * @return false if the ring is full, nothing was queued then.
+    */
+   bool try_push(const transaction& t);
+
+   /**
+    * @brief Copies t into the ring, waiting for room while it is full. Any thread.
+    */
+   void push(const transaction& t);
+
+   /**
+    * @brief Blocks until every transaction pushed before the call is applied.
+    * @throw std::exception Whatever applying or settling last failed with, if it hasn't been reported yet.
+    */
+   void drain();
+
+   /**
+    * @brief drain(), then settles the database on the apply thread.
+    * @throw std::exception Whatever applying or settling last failed with, if it hasn't been reported yet.
+    */
+   void settle();
+
+   /**
+    * @return transactions pushed but not taken by the apply thread yet. Any thread, a moment's estimate.
+    */
+   size_t depth() const;
+
+   size_t capacity() const { return slot_count; }
+
+   /**
+    * @return counters since the queue started. Any thread.
+    */
+   ingest_queue_stats get_stats() const;
+
+   // one slot per cache line, so producers filling neighbouring slots don't bounce each other's lines
+   struct alignas(cache_line) slot {
+      std::atomic<size_t> sequence; ///< position + 1 once filled for position, position + capacity once taken
+      transaction value;
+   };
+
+private:
+   transaction_db& db;
+   const size_t slot_count;
+   const size_t mask;
+   const size_t max_batch;
+   const apply_batch apply;
+   cache_aligned_array<slot> ring;
+
+   // producers hammer tail and the apply thread head, each starts a cache line so they don't share one. Their offsets
+   // are whole lines apart, so that holds even where new doesn't honor the queue's alignment
+   alignas(cache_line) std::atomic<size_t> tail;              ///< next position a producer claims
+   alignas(cache_line) std::atomic<size_t> head;              ///< next position the apply thread takes, only written by it
+   alignas(cache_line) std::atomic<bool> consumer_sleeping;   ///< the apply thread waits on wake
+   std::atomic<size_t> producers_waiting;                     ///< push() calls waiting on room
+   std::atomic<std::uint64_t> full_waits;
+   std::atomic<std::uint64_t> full_fails;
+
+   std::mutex lock;
+   std::condition_variable wake;  ///< signaled when a slot is filled, a request comes in or the queue stops
+   std::condition_variable room;  ///< signaled when a batch was taken off the ring and a producer waits
+   std::condition_variable done;  ///< signaled when a request is finished
+   bool stopping;
+   std::atomic<bool> request_pending; ///< also checked without lock between batches
+   bool request_settle;           ///< settle once the request's transactions are applied
+   size_t request_target;         ///< tail when the request came in
+   std::exception_ptr error;      ///< first failure not reported yet
+
+   std::mutex request_lock;       ///< one drain() or settle() at a time
+
+   mutable std::mutex stats_lock;
+   ingest_queue_stats stats;      ///< apply side counters
+
+   std::vector<transaction> batch; ///< apply thread only
+   std::thread worker;             ///< last, so everything above is set up before it starts
+
+   static cache_aligned_array<slot> make_ring(const size_t slot_count);
+   bool enqueue(const transaction& t);
+   bool ready(const size_t position) const;
+   bool has_room() const;
+   size_t take();
+   void run();
+   void request(const bool settle);
+   void rethrow_error();
+};
+
+#endif // INGEST_QUEUE_HPP
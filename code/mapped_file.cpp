@@ -0,0 +1,51 @@
+#include "mapped_file.hpp"
+
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+/**
+ * Maps the whole file read-only. The descriptor is closed right away, the mapping keeps the file alive.
+ * An empty file can't be mapped, so it is represented by a nullptr with a length of 0.
+ */
+mapped_file::mapped_file(const char* path): memory(nullptr), length(0)
+{
+   const int fd = ::open(path, O_RDONLY);
+   if (fd < 0) {
+      throw std::runtime_error(string("Could not open ") + path + ": " + strerror(errno));
+   }
+
+   struct stat info;
+   if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw std::runtime_error(string("Could not stat ") + path + ": " + strerror(errno));
+   }
+
+   length = static_cast<size_t>(info.st_size);
+   if (length != 0) {
+      void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+         ::close(fd);
+         throw std::runtime_error(string("Could not map ") + path + ": " + strerror(errno));
+      }
+
+      // the file is parsed front to back exactly once
+      ::madvise(mapping, length, MADV_SEQUENTIAL);
+      memory = static_cast<const char*>(mapping);
+   }
+   ::close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+   if (memory) {
+      ::munmap(const_cast<char*>(memory), length);
+   }
+}
@@ -0,0 +1,28 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+
+/**
+ * @brief Read-only memory map of a whole file. The file is unmapped on destruction.
+ */
+class mapped_file {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be opened or mapped.
+    */
+   explicit mapped_file(const char* path);
+   ~mapped_file();
+
+   mapped_file(const mapped_file&) = delete;
+   mapped_file& operator=(const mapped_file&) = delete;
+
+   const char* data() const { return memory; }
+   size_t size() const { return length; }
+
+private:
+   const char* memory; ///< start of the mapping, nullptr for an empty file
+   size_t length;      ///< size of the file in bytes
+};
+
+#endif // MAPPED_FILE_HPP
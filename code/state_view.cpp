@@ -0,0 +1,96 @@
+#include "state_view.hpp"
+
+#include <utility>
+using namespace std;
+
+constexpr size_t state_view::page_size;
+
+size_t state_view::applied_count() const
+{
+   size_t count = base ? base->applied().size() : 0;
+   for (const auto& s: applied) {
+      count += s->size();
+   }
+   return count;
+}
+
+vector<account_balance> state_view::get_balances() const
+{
+   std::vector<account_balance> balances;
+   balances.reserve(account_count);
+   for (const auto& p: pages) {
+      balances.insert(balances.end(), p->begin(), p->end());
+   }
+   return balances;
+}
+
+/**
+ * Every id in base is older than every id in the segments, and the segments are in commit order, so the result is sorted.
+ */
+vector<size_t> state_view::get_applied_transactions() const
+{
+   std::vector<size_t> ids;
+   ids.reserve(applied_count());
+   if (base) {
+      ids.assign(base->applied().begin(), base->applied().end());
+   }
+   for (const auto& s: applied) {
+      ids.insert(ids.end(), s->begin(), s->end());
+   }
+   return ids;
+}
+
+published_views::published_views(const size_t max_readers): epochs(max_readers)
+{
+   latest[0].store(nullptr);
+   latest[1].store(nullptr);
+}
+
+/**
+ * The same view is often published as both kinds, owned keeps it alive as long as either needs it.
+ */
+void published_views::publish(const read_view which, std::shared_ptr<const state_view> view)
+{
+   const size_t i = static_cast<size_t>(which);
+   latest[i].store(view.get());
+   std::shared_ptr<const state_view> old = std::move(owned[i]);
+   owned[i] = std::move(view);
+   epochs.retire(std::move(old));
+   epochs.collect();
+}
+
+read_snapshot::read_snapshot(epoch_domain* epochs, const size_t slot, const state_view* view): epochs(epochs), slot(slot), view(view)
+{
+}
+
+read_snapshot::read_snapshot(read_snapshot&& other): epochs(other.epochs), slot(other.slot), view(other.view)
+{
+   other.epochs = nullptr;
+}
+
+read_snapshot::~read_snapshot()
+{
+   if (epochs) {
+      epochs->unpin(slot);
+   }
+}
+
+vector<account_balance> read_snapshot::get_balances() const
+{
+   return view->get_balances();
+}
+
+vector<size_t> read_snapshot::get_applied_transactions() const
+{
+   return view->get_applied_transactions();
+}
+
+size_t read_snapshot::next_transaction() const
+{
+   return view->next_transaction;
+}
+
+bool read_snapshot::is_settled() const
+{
+   return view->settled;
+}
@@ -0,0 +1,59 @@
+#ifndef STATE_VIEW_HPP
+#define STATE_VIEW_HPP
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "binary_format.hpp"
+#include "epoch_domain.hpp"
+#include "transaction_db.hpp"
+
+/**
+ * @brief Balances and applied transactions as of one point, plus what a snapshot needs to find its place in the
+ *        write-ahead log. Built by transaction_db at the end of a commit, or between pushes for publish_balances().
+ *
+ *        Immutable once built, so snapshots and readers use it on other threads while the database moves on.
+ *        It is copy-on-write at the page level: the next view shares every page of accounts that wasn't touched in
+ *        between, and every segment of applied ids. Building one costs the touched pages plus a pointer per page.
+ */
+struct state_view {
+   static constexpr size_t page_size = 128; ///< accounts per page
+
+   using page = std::vector<account_balance>;
+   using segment = std::vector<std::uint64_t>;
+
+   bool settled;               ///< false if pending transactions are applied to the balances
+   size_t next_transaction;
+   std::uint64_t wal_offset;   ///< last write-ahead log record included, see write_ahead_log::last_record_offset(). 0 without a log
+   std::uint32_t wal_checksum;
+   size_t account_count;
+   std::vector<std::shared_ptr<const page>> pages; ///< accounts in dense index order, page_size per page
+   std::shared_ptr<const snapshot_reader> base;    ///< snapshot the database was loaded from, nullptr if none. Its applied ids come first
+   std::vector<std::shared_ptr<const segment>> applied; ///< applied ids committed since base, ascending across segments
+
+   size_t applied_count() const;
+   std::vector<account_balance> get_balances() const;
+   std::vector<size_t> get_applied_transactions() const;
+};
+
+/**
+ * @brief The views readers can pin through transaction_db::read_balances(), one per read_view.
+ *        Only the database's own thread publishes, any thread reads.
+ */
+struct published_views {
+   explicit published_views(const size_t max_readers);
+
+   /**
+    * @brief Makes view the one readers asking for which get, and retires the one it replaces.
+    */
+   void publish(const read_view which, std::shared_ptr<const state_view> view);
+
+   epoch_domain epochs;
+   std::atomic<const state_view*> latest[2];   ///< indexed by read_view, what readers load
+   std::shared_ptr<const state_view> owned[2]; ///< keeps latest alive until it is retired
+};
+
+#endif // STATE_VIEW_HPP
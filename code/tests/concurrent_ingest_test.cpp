@@ -0,0 +1,133 @@
+/**
+ * Concurrent ingest from many producer threads. Build and run with `make test`.
+ */
+#include "transaction_db.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+using namespace std;
+
+/**
+ * Rejected pushes report to std::cerr. Swallows that while it lives.
+ */
+struct quiet_cerr {
+   ostringstream sink;
+   streambuf* saved = std::cerr.rdbuf(sink.rdbuf());
+   ~quiet_cerr() { std::cerr.rdbuf(saved); }
+};
+
+static vector<account_balance> make_accounts(const int count, const int balance)
+{
+   vector<account_balance> accounts;
+   for (int id = 0; id < count; ++id) {
+      accounts.push_back({id, balance});
+   }
+   return accounts;
+}
+
+/**
+ * Every tenth transaction names an account that doesn't exist. Amounts are big enough to overdraw.
+ */
+static vector<transaction> make_batch(const size_t count, const int accounts)
+{
+   vector<transaction> batch;
+   for (size_t i = 0; i < count; ++i) {
+      const int from = static_cast<int>(i * 7 % accounts);
+      const int to = i % 10 == 9 ? accounts + 1 : static_cast<int>((i * 11 + 3) % accounts);
+      batch.push_back({{from, to, static_cast<int>(i % 40 + 1)}, {to, (from + 1) % accounts, 2}});
+   }
+   return batch;
+}
+
+static void expect_same_state(const transaction_db& db, const transaction_db& expected)
+{
+   const auto balances = db.get_balances();
+   const auto expected_balances = expected.get_balances();
+   ASSERT_EQ(balances.size(), expected_balances.size());
+   for (size_t i = 0; i < balances.size(); ++i) {
+      EXPECT_EQ(balances[i].balance, expected_balances[i].balance) << "account " << balances[i].account_id;
+   }
+   EXPECT_EQ(db.get_applied_transactions(), expected.get_applied_transactions());
+}
+
+/**
+ * With one producer the ids come out in push order, so the settle has to match push_transaction() exactly.
+ */
+TEST(concurrent_ingest, one_producer_matches_push)
+{
+   quiet_cerr quiet;
+   const auto batch = make_batch(500, 20);
+   transaction_db db(make_accounts(20, 30));
+   transaction_db expected(make_accounts(20, 30));
+
+   db.begin_ingest(1);
+   for (const auto& t: batch) {
+      EXPECT_EQ(db.ingest_transaction(t), expected.push_transactions(array_view<const transaction>(&t, 1)).front());
+   }
+   db.end_ingest();
+   expect_same_state(db, expected);
+
+   db.settle();
+   expected.settle();
+   expect_same_state(db, expected);
+}
+
+/**
+ * Many producers pick their own order, but addition doesn't care: with nothing overdrawn the balances and the
+ * accepted count match a sequential push, and the ids stay dense.
+ */
+TEST(concurrent_ingest, many_producers_match_sequential_balances)
+{
+   quiet_cerr quiet;
+   const auto batch = make_batch(8000, 50);
+   transaction_db db(make_accounts(50, 1000000));
+   transaction_db expected(make_accounts(50, 1000000));
+   for (const auto& t: batch) {
+      expected.push_transaction(t);
+   }
+
+   const size_t producers = 4;
+   atomic<size_t> rejected(0);
+   db.begin_ingest(producers);
+   vector<thread> threads;
+   for (size_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p]() {
+         for (size_t i = p; i < batch.size(); i += producers) {
+            rejected += db.ingest_transaction(batch[i]) == push_status::invalid_account;
+         }
+      });
+   }
+   for (auto& t: threads) {
+      t.join();
+   }
+   db.end_ingest();
+
+   db.settle();
+   expected.settle();
+   expect_same_state(db, expected);
+   EXPECT_EQ(rejected.load(), batch.size() / 10);
+
+   vector<size_t> dense(batch.size() - rejected.load());
+   std::iota(dense.begin(), dense.end(), 0);
+   EXPECT_EQ(db.get_applied_transactions(), dense);
+}
+
+TEST(concurrent_ingest, only_between_begin_and_end)
+{
+   transaction_db db(make_accounts(2, 10));
+   EXPECT_THROW(db.ingest_transaction({{0, 1, 1}}), std::logic_error);
+   EXPECT_THROW(db.end_ingest(), std::logic_error);
+
+   db.begin_ingest(1);
+   EXPECT_THROW(db.begin_ingest(1), std::logic_error);
+   EXPECT_THROW(db.settle(), std::logic_error);
+   db.end_ingest();
+   db.settle();
+}
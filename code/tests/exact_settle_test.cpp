@@ -0,0 +1,240 @@
+/**
+ * The exact settle against trying every drop set. Build and run with `make test`.
+ */
+#include "transaction_db.hpp"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+using namespace std;
+
+/**
+ * Account ids are 0 to accounts.size() - 1, and accounts holds their balances before any transaction.
+ */
+struct workload {
+   vector<long long> accounts;
+   vector<transaction> transactions;
+};
+
+/**
+ * Few accounts with little money, so plenty of transactions overdraw. With allow_negative some accounts start below 0.
+ */
+static workload random_workload(const unsigned seed, const int accounts, const int transactions, const bool allow_negative)
+{
+   mt19937 random(seed);
+   workload w;
+   for (int id = 0; id < accounts; ++id) {
+      w.accounts.push_back(static_cast<long long>(random() % 16) - (allow_negative && random() % 4 == 0 ? 12 : 0));
+   }
+   for (int i = 0; i < transactions; ++i) {
+      transaction t;
+      const int transfers = static_cast<int>(random() % 2) + 1;
+      for (int k = 0; k < transfers; ++k) {
+         const int from = static_cast<int>(random() % accounts);
+         const int to = (from + 1 + static_cast<int>(random() % (accounts - 1))) % accounts;
+         t.push_back({from, to, static_cast<int>(random() % 12) + 1});
+      }
+      w.transactions.push_back(t);
+   }
+   return w;
+}
+
+/**
+ * @return balances with the transactions kept[i] is true for applied.
+ */
+static vector<long long> apply(const workload& w, const vector<bool>& kept)
+{
+   vector<long long> balances = w.accounts;
+   for (size_t i = 0; i < w.transactions.size(); ++i) {
+      if (kept[i]) {
+         for (const auto& x: w.transactions[i]) {
+            balances[x.from] -= x.amount;
+            balances[x.to] += x.amount;
+         }
+      }
+   }
+   return balances;
+}
+
+/**
+ * @return fewest drops that leave every account in target >= 0, or -1 if no drop set does.
+ */
+static int fewest_drops(const workload& w, const vector<bool>& target)
+{
+   const size_t n = w.transactions.size();
+   int best = -1;
+   for (size_t mask = 0; mask < (size_t(1) << n); ++mask) {
+      vector<bool> kept(n);
+      int drops = 0;
+      for (size_t i = 0; i < n; ++i) {
+         kept[i] = !(mask >> i & 1);
+         drops += !kept[i];
+      }
+      if (best != -1 && drops >= best) {
+         continue;
+      }
+
+      const vector<long long> balances = apply(w, kept);
+      bool valid = true;
+      for (size_t a = 0; a < balances.size(); ++a) {
+         valid = valid && (!target[a] || balances[a] >= 0);
+      }
+      if (valid) {
+         best = drops;
+      }
+   }
+   return best;
+}
+
+/**
+ * What exact_settler has to fix: first every account dropping withdrawals can bring to >= 0. If no drop set manages
+ * that, only the accounts that were >= 0 before any transaction.
+ */
+static vector<bool> target_of(const workload& w, bool& fallback)
+{
+   vector<long long> repaired = w.accounts;
+   for (const auto& t: w.transactions) {
+      for (const auto& x: t) {
+         repaired[x.to] += x.amount;
+      }
+   }
+
+   vector<bool> target(w.accounts.size());
+   for (size_t a = 0; a < target.size(); ++a) {
+      target[a] = repaired[a] >= 0;
+   }
+   fallback = fewest_drops(w, target) == -1;
+   if (fallback) {
+      for (size_t a = 0; a < target.size(); ++a) {
+         target[a] = target[a] && w.accounts[a] >= 0;
+      }
+   }
+   return target;
+}
+
+static vector<bool> solve(const workload& w)
+{
+   vector<unique_ptr<transaction_log>> storage;
+   vector<const transaction_log*> logs;
+   for (size_t i = 0; i < w.transactions.size(); ++i) {
+      storage.push_back(make_unique<transaction_log>(w.transactions[i], i, [](transfer&) { return true; }));
+      logs.push_back(storage.back().get());
+   }
+
+   const vector<long long> current = apply(w, vector<bool>(w.transactions.size(), true));
+   exact_settler search(logs, [&current](int account_id) { return static_cast<int>(current[account_id]); });
+   return search.solve();
+}
+
+TEST(exact_settle, matches_brute_force)
+{
+   for (unsigned seed = 0; seed < 200; ++seed) {
+      const workload w = random_workload(seed, 5, 12, false);
+      const vector<bool> dropped = solve(w);
+
+      vector<bool> kept(dropped.size());
+      int drops = 0;
+      for (size_t i = 0; i < dropped.size(); ++i) {
+         kept[i] = !dropped[i];
+         drops += dropped[i];
+      }
+      for (const long long balance: apply(w, kept)) {
+         EXPECT_GE(balance, 0) << "seed " << seed;
+      }
+      EXPECT_EQ(drops, fewest_drops(w, vector<bool>(w.accounts.size(), true))) << "seed " << seed;
+   }
+}
+
+/**
+ * Accounts that start negative may not be repairable. Those stay negative, and everything else is still settled
+ * with the fewest drops.
+ */
+TEST(exact_settle, leaves_out_what_cant_be_repaired)
+{
+   size_t fallbacks = 0;
+   for (unsigned seed = 0; seed < 300; ++seed) {
+      const workload w = random_workload(seed, 5, 12, true);
+      bool fallback = false;
+      const vector<bool> target = target_of(w, fallback);
+      fallbacks += fallback;
+      const vector<bool> dropped = solve(w);
+
+      vector<bool> kept(dropped.size());
+      int drops = 0;
+      for (size_t i = 0; i < dropped.size(); ++i) {
+         kept[i] = !dropped[i];
+         drops += dropped[i];
+      }
+      const vector<long long> balances = apply(w, kept);
+      for (size_t a = 0; a < balances.size(); ++a) {
+         if (target[a]) {
+            EXPECT_GE(balances[a], 0) << "seed " << seed << " account " << a;
+         }
+      }
+      EXPECT_EQ(drops, fewest_drops(w, target)) << "seed " << seed;
+   }
+   EXPECT_GT(fallbacks, 0u);
+}
+
+TEST(exact_settle, settles_the_database)
+{
+   for (unsigned seed = 0; seed < 50; ++seed) {
+      const workload w = random_workload(seed, 5, 12, false);
+      vector<account_balance> initial;
+      for (size_t a = 0; a < w.accounts.size(); ++a) {
+         initial.push_back({static_cast<int>(a), static_cast<int>(w.accounts[a])});
+      }
+
+      transaction_db db(initial);
+      db.set_settle_mode(settle_mode::branch_and_bound);
+      for (const auto& t: w.transactions) {
+         db.push_transaction(t);
+      }
+      db.settle();
+
+      const auto applied = db.get_applied_transactions();
+      EXPECT_EQ(static_cast<int>(w.transactions.size() - applied.size()), fewest_drops(w, vector<bool>(w.accounts.size(), true)))
+         << "seed " << seed;
+      for (const auto& a: db.get_balances()) {
+         EXPECT_GE(a.balance, 0) << "seed " << seed;
+      }
+   }
+}
+
+/**
+ * A search that runs out of nodes settles the scope greedily and says so in the stats.
+ */
+TEST(exact_settle, falls_back_to_greedy_out_of_nodes)
+{
+   size_t fallbacks = 0;
+   for (unsigned seed = 0; seed < 50; ++seed) {
+      const workload w = random_workload(seed, 5, 12, false);
+      vector<account_balance> initial;
+      for (size_t a = 0; a < w.accounts.size(); ++a) {
+         initial.push_back({static_cast<int>(a), static_cast<int>(w.accounts[a])});
+      }
+
+      transaction_db exact(initial);
+      exact.set_settle_mode(settle_mode::branch_and_bound);
+      exact.set_exact_node_limit(1);
+      transaction_db greedy(initial);
+      for (const auto& t: w.transactions) {
+         exact.push_transaction(t);
+         greedy.push_transaction(t);
+      }
+      exact.settle();
+      greedy.settle();
+
+      const std::uint64_t fell_back = exact.get_stats().last_settle.exact_fallbacks;
+      fallbacks += fell_back;
+      if (fell_back) {
+         EXPECT_EQ(exact.get_applied_transactions(), greedy.get_applied_transactions()) << "seed " << seed;
+      }
+      for (const auto& a: exact.get_balances()) {
+         EXPECT_GE(a.balance, 0) << "seed " << seed;
+      }
+   }
+   EXPECT_GT(fallbacks, 0u);
+}
@@ -0,0 +1,121 @@
+/**
+ * indexed_heap against a std::set doing the same thing. Build and run with `make test`.
+ */
+#include "indexed_heap.hpp"
+
+#include <set>
+#include <random>
+#include <vector>
+#include <utility>
+
+#include <gtest/gtest.h>
+using namespace std;
+
+/**
+ * Keys end in the handle, like the greedy settle's scores, so the smallest one is never a tie.
+ */
+typedef pair<int, size_t> key;
+
+static void expect_same(const indexed_heap<key>& heap, const set<key>& reference, const vector<size_t>& slot_of)
+{
+   ASSERT_EQ(heap.size(), reference.size());
+   ASSERT_EQ(heap.empty(), reference.empty());
+   if (!reference.empty()) {
+      EXPECT_EQ(heap.top(), *reference.begin());
+   }
+   size_t filed = 0;
+   for (size_t handle = 0; handle < slot_of.size(); ++handle) {
+      filed += heap.contains(handle);
+   }
+   EXPECT_EQ(filed, reference.size());
+}
+
+TEST(indexed_heap, matches_ordered_set)
+{
+   const size_t handles = 64;
+   mt19937 random(7);
+   vector<size_t> slot_of(handles, indexed_heap<key>::npos);
+   vector<int> value(handles);
+   set<key> reference;
+   indexed_heap<key> heap(slot_of);
+
+   for (int step = 0; step < 20000; ++step) {
+      const size_t handle = random() % handles;
+      switch (random() % 4) {
+      case 0:
+      case 1:
+         reference.erase({value[handle], handle});
+         value[handle] = static_cast<int>(random() % 100);
+         reference.insert({value[handle], handle});
+         heap.set(handle, {value[handle], handle});
+         break;
+      case 2:
+         reference.erase({value[handle], handle});
+         heap.erase(handle);
+         break;
+      default:
+         if (!reference.empty()) {
+            const size_t top = reference.begin()->second;
+            reference.erase(reference.begin());
+            heap.erase(top);
+         }
+         break;
+      }
+      expect_same(heap, reference, slot_of);
+   }
+}
+
+TEST(indexed_heap, build_and_rekey_all)
+{
+   const size_t handles = 200;
+   mt19937 random(11);
+   vector<size_t> slot_of(handles, indexed_heap<key>::npos);
+   set<key> reference;
+   indexed_heap<key> heap(slot_of);
+
+   for (size_t handle = 0; handle < handles; handle += 2) {
+      const key k(static_cast<int>(random() % 1000), handle);
+      heap.push_unordered(handle, k);
+      reference.insert(k);
+   }
+   heap.build();
+   expect_same(heap, reference, slot_of);
+
+   // every third handle leaves, the rest get new keys
+   set<key> rekeyed;
+   heap.rekey_all([&random, &rekeyed](const size_t handle, key& k) {
+      if (handle % 3 == 0) {
+         return false;
+      }
+      k.first = static_cast<int>(random() % 1000);
+      rekeyed.insert(k);
+      return true;
+   });
+   expect_same(heap, rekeyed, slot_of);
+
+   while (!rekeyed.empty()) {
+      ASSERT_EQ(heap.top(), *rekeyed.begin());
+      heap.erase(heap.top().second);
+      rekeyed.erase(rekeyed.begin());
+   }
+   EXPECT_TRUE(heap.empty());
+}
+
+TEST(indexed_heap, leaves_slots_empty)
+{
+   vector<size_t> slot_of(8, indexed_heap<key>::npos);
+   {
+      indexed_heap<key> heap(slot_of);
+      for (size_t handle = 0; handle < 8; ++handle) {
+         heap.set(handle, {static_cast<int>(8 - handle), handle});
+      }
+      heap.erase(3);
+   }
+   EXPECT_EQ(slot_of, vector<size_t>(8, indexed_heap<key>::npos));
+
+   indexed_heap<key> heap(slot_of);
+   heap.set(5, {1, 5});
+   heap.clear();
+   EXPECT_FALSE(heap.contains(5));
+   EXPECT_EQ(slot_of[5], indexed_heap<key>::npos);
+}
@@ -0,0 +1,197 @@
+/**
+ * The bounded ingest queue in front of the database. Build and run with `make test`.
+ */
+#include "ingest_queue.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <condition_variable>
+
+#include <gtest/gtest.h>
+using namespace std;
+
+static vector<account_balance> make_accounts(const int count, const int balance)
+{
+   vector<account_balance> accounts;
+   for (int id = 0; id < count; ++id) {
+      accounts.push_back({id, balance});
+   }
+   return accounts;
+}
+
+static void expect_same_state(const transaction_db& db, const transaction_db& expected)
+{
+   const auto balances = db.get_balances();
+   const auto expected_balances = expected.get_balances();
+   ASSERT_EQ(balances.size(), expected_balances.size());
+   for (size_t i = 0; i < balances.size(); ++i) {
+      EXPECT_EQ(balances[i].balance, expected_balances[i].balance) << "account " << balances[i].account_id;
+   }
+   EXPECT_EQ(db.get_applied_transactions(), expected.get_applied_transactions());
+}
+
+/**
+ * An apply_batch that holds the apply thread until the test opens it, so the ring fills up.
+ */
+struct apply_gate {
+   static mutex lock;
+   static condition_variable changed;
+   static bool open;
+   static size_t entered;
+
+   static void reset()
+   {
+      lock_guard<mutex> guard(lock);
+      open = false;
+      entered = 0;
+   }
+
+   static vector<push_status> apply(transaction_db& db, array_view<const transaction> batch)
+   {
+      unique_lock<mutex> guard(lock);
+      ++entered;
+      changed.notify_all();
+      changed.wait(guard, []() { return open; });
+      guard.unlock();
+      return push_batch<>(db, batch);
+   }
+
+   static void wait_entered()
+   {
+      unique_lock<mutex> guard(lock);
+      changed.wait(guard, []() { return entered > 0; });
+   }
+
+   static void release()
+   {
+      lock_guard<mutex> guard(lock);
+      open = true;
+      changed.notify_all();
+   }
+};
+
+mutex apply_gate::lock;
+condition_variable apply_gate::changed;
+bool apply_gate::open = false;
+size_t apply_gate::entered = 0;
+
+static vector<push_status> failing_apply(transaction_db&, array_view<const transaction>)
+{
+   throw std::runtime_error("apply failed");
+}
+
+/**
+ * The apply thread holds one transaction it already took, the ring holds four more. The next try_push() fails and
+ * push() waits until the apply thread makes room.
+ */
+TEST(ingest_queue, full_ring_pushes_back)
+{
+   apply_gate::reset();
+   transaction_db db(make_accounts(2, 100));
+   {
+      ingest_queue queue(db, 4, 1, &apply_gate::apply);
+      ASSERT_EQ(queue.capacity(), 4u);
+
+      queue.push({{0, 1, 1}});
+      apply_gate::wait_entered();
+      for (int i = 0; i < 4; ++i) {
+         EXPECT_TRUE(queue.try_push({{0, 1, 1}}));
+      }
+      EXPECT_FALSE(queue.try_push({{0, 1, 1}}));
+      EXPECT_EQ(queue.depth(), 4u);
+
+      atomic<bool> pushed(false);
+      thread producer([&]() {
+         queue.push({{0, 1, 1}});
+         pushed = true;
+      });
+      this_thread::sleep_for(chrono::milliseconds(50));
+      EXPECT_FALSE(pushed.load());
+
+      apply_gate::release();
+      producer.join();
+      queue.drain();
+
+      const ingest_queue_stats stats = queue.get_stats();
+      EXPECT_EQ(stats.enqueued, 6u);
+      EXPECT_EQ(stats.applied, 6u);
+      EXPECT_EQ(stats.full_fails, 1u);
+      EXPECT_GE(stats.full_waits, 1u);
+      EXPECT_EQ(stats.depth, 0u);
+      queue.settle();
+   }
+   EXPECT_EQ(db.get_balances()[1].balance, 106);
+}
+
+/**
+ * With one producer the queue keeps push order, so settling matches pushing straight into the database.
+ */
+TEST(ingest_queue, one_producer_matches_push)
+{
+   transaction_db db(make_accounts(10, 20));
+   transaction_db expected(make_accounts(10, 20));
+   {
+      ingest_queue queue(db, 16, 4);
+      for (int i = 0; i < 300; ++i) {
+         const transaction t = {{i % 10, (i * 3 + 1) % 10, i % 25 + 1}};
+         queue.push(t);
+         expected.push_transaction(t);
+      }
+      queue.settle();
+   }
+   expected.settle();
+   expect_same_state(db, expected);
+}
+
+/**
+ * Many producers pick their own order, but with nothing overdrawn the balances still match a sequential push.
+ */
+TEST(ingest_queue, many_producers_match_sequential_balances)
+{
+   const size_t producers = 4;
+   const int per_producer = 2000;
+   transaction_db db(make_accounts(32, 1000000));
+   transaction_db expected(make_accounts(32, 1000000));
+   {
+      ingest_queue queue(db, 64, 16);
+      vector<thread> threads;
+      for (size_t p = 0; p < producers; ++p) {
+         threads.emplace_back([&queue, p]() {
+            for (int i = 0; i < per_producer; ++i) {
+               queue.push({{static_cast<int>((p * 5 + i) % 32), static_cast<int>((i * 7 + p) % 32), i % 9 + 1}});
+            }
+         });
+      }
+      for (auto& t: threads) {
+         t.join();
+      }
+      queue.settle();
+      EXPECT_EQ(queue.get_stats().applied, producers * per_producer);
+   }
+
+   for (size_t p = 0; p < producers; ++p) {
+      for (int i = 0; i < per_producer; ++i) {
+         expected.push_transaction({{static_cast<int>((p * 5 + i) % 32), static_cast<int>((i * 7 + p) % 32), i % 9 + 1}});
+      }
+   }
+   expected.settle();
+   const auto balances = db.get_balances();
+   const auto expected_balances = expected.get_balances();
+   for (size_t i = 0; i < balances.size(); ++i) {
+      EXPECT_EQ(balances[i].balance, expected_balances[i].balance) << "account " << balances[i].account_id;
+   }
+   EXPECT_EQ(db.get_applied_transactions().size(), producers * per_producer);
+}
+
+TEST(ingest_queue, drain_reports_apply_failure_once)
+{
+   transaction_db db(make_accounts(2, 10));
+   ingest_queue queue(db, 8, 4, &failing_apply);
+   queue.push({{0, 1, 1}});
+   EXPECT_THROW(queue.drain(), std::runtime_error);
+   EXPECT_NO_THROW(queue.drain());
+}
@@ -0,0 +1,115 @@
+/**
+ * Read snapshots handed to other threads while the database keeps changing. Build and run with `make test`.
+ */
+#include "transaction_db.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+using namespace std;
+
+static long long total(const vector<account_balance>& balances)
+{
+   return std::accumulate(balances.begin(), balances.end(), 0LL, [](long long sum, const account_balance& a) { return sum + a.balance; });
+}
+
+TEST(read_snapshot, settled_view_leaves_out_pending)
+{
+   transaction_db db({{1, 10}, {2, 0}});
+   db.enable_read_snapshots();
+   db.push_transaction({{1, 2, 4}});
+
+   {
+      read_snapshot settled = db.read_balances();
+      EXPECT_TRUE(settled.is_settled());
+      EXPECT_EQ(settled.get_balances()[0].balance, 10);
+      EXPECT_TRUE(settled.get_applied_transactions().empty());
+   }
+
+   db.publish_balances();
+   {
+      read_snapshot current = db.read_balances(read_view::current);
+      EXPECT_FALSE(current.is_settled());
+      EXPECT_EQ(current.get_balances()[0].balance, 6);
+      EXPECT_EQ(current.next_transaction(), 1u);
+   }
+
+   db.settle();
+   read_snapshot settled = db.read_balances();
+   EXPECT_EQ(settled.get_balances()[1].balance, 4);
+   EXPECT_EQ(settled.get_applied_transactions(), vector<size_t>({0}));
+}
+
+TEST(read_snapshot, held_version_does_not_change)
+{
+   transaction_db db({{1, 10}, {2, 0}});
+   db.enable_read_snapshots();
+   db.push_transaction({{1, 2, 4}});
+   db.settle();
+
+   read_snapshot held = db.read_balances();
+   for (int i = 0; i < 10; ++i) {
+      db.push_transaction({{1, 2, 1}});
+      db.settle();
+   }
+
+   EXPECT_EQ(held.get_balances()[0].balance, 6);
+   EXPECT_EQ(held.get_applied_transactions(), vector<size_t>({0}));
+   EXPECT_EQ(db.read_balances().get_balances()[0].balance, 0);
+}
+
+TEST(read_snapshot, needs_enable_read_snapshots)
+{
+   transaction_db db({{1, 10}});
+   EXPECT_THROW(db.read_balances(), std::logic_error);
+   EXPECT_THROW(db.publish_balances(), std::logic_error);
+}
+
+/**
+ * Transfers only move money around, so every version any reader sees has to add up to the starting total, and
+ * versions never go back in time.
+ */
+TEST(read_snapshot, readers_see_whole_versions_while_settling)
+{
+   vector<account_balance> initial;
+   for (int id = 0; id < 64; ++id) {
+      initial.push_back({id, 100});
+   }
+   transaction_db db(initial);
+   db.enable_read_snapshots();
+
+   atomic<bool> done(false);
+   atomic<int> bad_totals(0);
+   atomic<int> went_back(0);
+   vector<thread> readers;
+   for (int r = 0; r < 3; ++r) {
+      readers.emplace_back([&]() {
+         size_t last = 0;
+         while (!done.load()) {
+            read_snapshot view = db.read_balances();
+            bad_totals += total(view.get_balances()) != 64 * 100;
+            went_back += view.next_transaction() < last;
+            last = view.next_transaction();
+         }
+      });
+   }
+
+   for (int round = 0; round < 200; ++round) {
+      for (int i = 0; i < 8; ++i) {
+         const int from = (round * 7 + i * 13) % 64;
+         db.push_transaction({{from, (from + 1 + i) % 64, 30 + i * 10}});
+      }
+      db.settle();
+   }
+   done = true;
+   for (auto& reader: readers) {
+      reader.join();
+   }
+
+   EXPECT_EQ(bad_totals.load(), 0);
+   EXPECT_EQ(went_back.load(), 0);
+}
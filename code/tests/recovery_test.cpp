@@ -0,0 +1,260 @@
+/**
+ * Write-ahead log and snapshot recovery. Build and run with `make test`.
+ */
+#include "transaction_db.hpp"
+
+#include <string>
+#include <cstdio>
+#include <vector>
+#include <fstream>
+
+#include <unistd.h>
+#include <gtest/gtest.h>
+using namespace std;
+
+/**
+ * A write-ahead log and a snapshot in the test's temporary directory, removed before and after each test.
+ */
+class recovery_test: public ::testing::Test {
+protected:
+   const string wal_path = ::testing::TempDir() + "recovery_test.wal";
+   const string snapshot_path = ::testing::TempDir() + "recovery_test.snap";
+
+   void SetUp() override { remove_files(); }
+   void TearDown() override { remove_files(); }
+
+   void remove_files()
+   {
+      std::remove(wal_path.c_str());
+      std::remove(snapshot_path.c_str());
+   }
+
+   long file_size() const
+   {
+      ifstream file(wal_path, ios::binary | ios::ate);
+      return static_cast<long>(file.tellg());
+   }
+};
+
+static void expect_balances(const transaction_db& db, const vector<account_balance>& expected)
+{
+   const vector<account_balance> balances = db.get_balances();
+   ASSERT_EQ(balances.size(), expected.size());
+   for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(balances[i].account_id, expected[i].account_id);
+      EXPECT_EQ(balances[i].balance, expected[i].balance);
+   }
+}
+
+TEST_F(recovery_test, replays_settled_log)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str());
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+   }
+
+   transaction_db db = transaction_db::recover(wal_path.c_str());
+   expect_balances(db, {{1, 6}, {2, 4}});
+   EXPECT_EQ(db.get_applied_transactions(), vector<size_t>({0}));
+}
+
+/**
+ * Transactions pushed after the last settle come back pending, and settle the way they would have.
+ */
+TEST_F(recovery_test, replays_pending_transactions)
+{
+   const vector<transaction> batch = {{{1, 2, 4}}, {{1, 3, 8}}, {{2, 3, 1}}};
+   transaction_db expected({{1, 10}, {2, 0}, {3, 0}});
+   {
+      transaction_db db({{1, 10}, {2, 0}, {3, 0}});
+      db.attach_wal(wal_path.c_str(), wal_sync::push);
+      db.push_transaction({{2, 1, 0}});
+      db.settle();
+      expected.push_transaction({{2, 1, 0}});
+      expected.settle();
+      for (const auto& t: batch) {
+         db.push_transaction(t);
+         expected.push_transaction(t);
+      }
+   }
+
+   transaction_db db = transaction_db::recover(wal_path.c_str());
+   db.settle();
+   expected.settle();
+   expect_balances(db, expected.get_balances());
+   EXPECT_EQ(db.get_applied_transactions(), expected.get_applied_transactions());
+}
+
+/**
+ * A crash in the middle of a write leaves part of the last record. Recovery stops before it, and the next record
+ * takes its place.
+ */
+TEST_F(recovery_test, drops_torn_record)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str(), wal_sync::push);
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+      db.push_transaction({{1, 2, 5}});
+   }
+   ASSERT_EQ(::truncate(wal_path.c_str(), file_size() - 3), 0);
+
+   {
+      transaction_db db = transaction_db::recover(wal_path.c_str(), wal_sync::push);
+      db.settle();
+      expect_balances(db, {{1, 6}, {2, 4}});
+      EXPECT_EQ(db.get_applied_transactions(), vector<size_t>({0}));
+
+      db.push_transaction({{2, 1, 1}});
+      db.settle();
+   }
+
+   transaction_db db = transaction_db::recover(wal_path.c_str());
+   expect_balances(db, {{1, 7}, {2, 3}});
+   EXPECT_EQ(db.get_applied_transactions(), vector<size_t>({0, 1}));
+}
+
+TEST_F(recovery_test, drops_record_with_bad_checksum)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str(), wal_sync::push);
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+      db.push_transaction({{1, 2, 5}});
+   }
+   {
+      fstream file(wal_path, ios::binary | ios::in | ios::out);
+      file.seekp(file_size() - 2);
+      file.put('\x7f');
+   }
+
+   transaction_db db = transaction_db::recover(wal_path.c_str());
+   db.settle();
+   expect_balances(db, {{1, 6}, {2, 4}});
+   EXPECT_EQ(db.get_applied_transactions(), vector<size_t>({0}));
+}
+
+TEST_F(recovery_test, rejects_file_that_is_not_a_log)
+{
+   {
+      ofstream file(wal_path, ios::binary);
+      file << "not a log at all";
+   }
+   EXPECT_THROW(transaction_db::recover(wal_path.c_str()), std::runtime_error);
+}
+
+/**
+ * Snapshots are only taken every other settle, so recovery has log records past the snapshot to replay.
+ */
+TEST_F(recovery_test, replays_log_past_snapshot)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}, {3, 0}});
+      db.attach_wal(wal_path.c_str());
+      db.enable_snapshots(snapshot_path.c_str(), 2);
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+      db.push_transaction({{2, 3, 3}});
+      db.push_transaction({{2, 3, 3}});
+      db.settle();
+      db.push_transaction({{1, 3, 1}});
+      db.settle();
+      db.push_transaction({{3, 1, 2}});
+      db.wait_for_snapshot();
+   }
+
+   transaction_db from_log = transaction_db::recover(wal_path.c_str());
+   transaction_db from_snapshot = transaction_db::recover(wal_path.c_str(), snapshot_path.c_str());
+   from_log.settle();
+   from_snapshot.settle();
+   expect_balances(from_snapshot, from_log.get_balances());
+   EXPECT_EQ(from_snapshot.get_applied_transactions(), from_log.get_applied_transactions());
+   EXPECT_EQ(from_snapshot.get_applied_transactions(), vector<size_t>({0, 2, 3, 4}));
+}
+
+TEST_F(recovery_test, missing_snapshot_recovers_from_log)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str());
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+   }
+
+   transaction_db db = transaction_db::recover(wal_path.c_str(), snapshot_path.c_str());
+   expect_balances(db, {{1, 6}, {2, 4}});
+}
+
+TEST_F(recovery_test, rejects_snapshot_of_another_log)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str());
+      db.enable_snapshots(snapshot_path.c_str());
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+      db.wait_for_snapshot();
+   }
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str());
+      db.push_transaction({{1, 2, 3}});
+      db.push_transaction({{2, 1, 1}});
+      db.settle();
+   }
+
+   EXPECT_THROW(transaction_db::recover(wal_path.c_str(), snapshot_path.c_str()), std::runtime_error);
+}
+
+/**
+ * The reopened log hasn't written anything yet, so the snapshot has to point at the last record recovery replayed.
+ */
+TEST_F(recovery_test, snapshot_right_after_recover)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str());
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+   }
+   {
+      transaction_db db = transaction_db::recover(wal_path.c_str());
+      db.enable_snapshots(snapshot_path.c_str());
+      db.settle(); // nothing pending, nothing logged
+      db.wait_for_snapshot();
+   }
+
+   transaction_db db = transaction_db::recover(wal_path.c_str(), snapshot_path.c_str());
+   expect_balances(db, {{1, 6}, {2, 4}});
+
+   // and the log carries on from there
+   db.push_transaction({{2, 1, 1}});
+   db.settle();
+   transaction_db again = transaction_db::recover(wal_path.c_str(), snapshot_path.c_str());
+   expect_balances(again, {{1, 7}, {2, 3}});
+}
+
+TEST_F(recovery_test, snapshot_right_after_recover_from_snapshot)
+{
+   {
+      transaction_db db({{1, 10}, {2, 0}});
+      db.attach_wal(wal_path.c_str());
+      db.enable_snapshots(snapshot_path.c_str());
+      db.push_transaction({{1, 2, 4}});
+      db.settle();
+      db.wait_for_snapshot();
+   }
+   {
+      transaction_db db = transaction_db::recover(wal_path.c_str(), snapshot_path.c_str());
+      db.enable_snapshots(snapshot_path.c_str());
+      db.settle();
+      db.wait_for_snapshot();
+   }
+
+   transaction_db db = transaction_db::recover(wal_path.c_str(), snapshot_path.c_str());
+   expect_balances(db, {{1, 6}, {2, 4}});
+}
@@ -0,0 +1,375 @@
+/**
+ * Settle strategies on small workloads, and scope by scope. Build and run with `make test`.
+ */
+#include "transaction_db.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+using namespace std;
+
+struct workload {
+   vector<account_balance> accounts;
+   vector<transaction> transactions;
+};
+
+/**
+ * A few accounts with little money and transactions of one to three transfers, so plenty of them overdraw.
+ */
+static workload random_workload(const unsigned seed, const int accounts, const int transactions)
+{
+   mt19937 random(seed);
+   workload w;
+   for (int id = 0; id < accounts; ++id) {
+      w.accounts.push_back({id, static_cast<int>(random() % 21)});
+   }
+   for (int i = 0; i < transactions; ++i) {
+      transaction t;
+      const int transfers = static_cast<int>(random() % 3) + 1;
+      for (int k = 0; k < transfers; ++k) {
+         const int from = static_cast<int>(random() % accounts);
+         const int to = (from + 1 + static_cast<int>(random() % (accounts - 1))) % accounts;
+         t.push_back({from, to, static_cast<int>(random() % 15) + 1});
+      }
+      w.transactions.push_back(t);
+   }
+   return w;
+}
+
+static transaction_db settled(const workload& w, const settle_mode mode)
+{
+   transaction_db db(w.accounts);
+   db.set_settle_mode(mode);
+   for (const auto& t: w.transactions) {
+      db.push_transaction(t);
+   }
+   db.settle();
+   return db;
+}
+
+/**
+ * The balances have to be the starting ones plus exactly the applied transactions, and none of them negative.
+ * Account ids are 0 to n - 1.
+ */
+static void expect_valid(const transaction_db& db, const workload& w)
+{
+   vector<long long> expected;
+   for (const auto& a: w.accounts) {
+      expected.push_back(a.balance);
+   }
+   for (const size_t id: db.get_applied_transactions()) {
+      ASSERT_LT(id, w.transactions.size());
+      for (const auto& x: w.transactions[id]) {
+         expected[x.from] -= x.amount;
+         expected[x.to] += x.amount;
+      }
+   }
+
+   const auto balances = db.get_balances();
+   ASSERT_EQ(balances.size(), expected.size());
+   for (size_t i = 0; i < balances.size(); ++i) {
+      EXPECT_EQ(balances[i].balance, expected[i]) << "account " << balances[i].account_id;
+      EXPECT_GE(balances[i].balance, 0) << "account " << balances[i].account_id;
+   }
+}
+
+TEST(forward_settle, leaves_no_negatives)
+{
+   for (unsigned seed = 0; seed < 50; ++seed) {
+      const workload w = random_workload(seed, 6, 30);
+      expect_valid(settled(w, settle_mode::forward), w);
+   }
+}
+
+/**
+ * The first transaction overdraws account 0 until the second one pays it. The third overdraws account 1 for good,
+ * so the batch needs settling.
+ */
+static const workload pays_later = {{{0, 0}, {1, 5}, {2, 0}}, {{{0, 2, 3}}, {{1, 0, 5}}, {{1, 2, 1}}}};
+
+TEST(forward_settle, window_waits_for_room)
+{
+   const transaction_db db = settled(pays_later, settle_mode::forward);
+   EXPECT_EQ(db.get_applied_transactions(), vector<size_t>({0, 1}));
+   expect_valid(db, pays_later);
+}
+
+TEST(forward_settle, no_window_keeps_only_what_fits)
+{
+   transaction_db db(pays_later.accounts);
+   db.set_settle_mode(settle_mode::forward);
+   db.set_forward_window(0);
+   for (const auto& t: pays_later.transactions) {
+      db.push_transaction(t);
+   }
+   db.settle();
+   EXPECT_EQ(db.get_applied_transactions(), vector<size_t>({1}));
+   expect_valid(db, pays_later);
+}
+
+static transaction_db settled_by(const workload& w, const chrono::steady_clock::time_point deadline)
+{
+   transaction_db db(w.accounts);
+   for (const auto& t: w.transactions) {
+      db.push_transaction(t);
+   }
+   db.settle(deadline);
+   return db;
+}
+
+/**
+ * Anytime starts from the forward settle and only takes moves that keep more, so it never drops more than forward.
+ */
+TEST(anytime_settle, keeps_at_least_what_forward_keeps)
+{
+   for (unsigned seed = 0; seed < 50; ++seed) {
+      const workload w = random_workload(seed, 6, 30);
+      const transaction_db db = settled_by(w, chrono::steady_clock::now() + chrono::seconds(10));
+      expect_valid(db, w);
+      EXPECT_GE(db.get_applied_transactions().size(), settled(w, settle_mode::forward).get_applied_transactions().size())
+         << "seed " << seed;
+   }
+}
+
+/**
+ * Past the deadline only the forward pass runs.
+ */
+TEST(anytime_settle, past_deadline_is_forward)
+{
+   for (unsigned seed = 0; seed < 20; ++seed) {
+      const workload w = random_workload(seed, 6, 30);
+      const transaction_db db = settled_by(w, chrono::steady_clock::now() - chrono::seconds(1));
+      expect_valid(db, w);
+      EXPECT_EQ(db.get_applied_transactions(), settled(w, settle_mode::forward).get_applied_transactions())
+         << "seed " << seed;
+   }
+}
+
+TEST(beam_settle, leaves_no_negatives)
+{
+   for (const size_t width: {1, 4}) {
+      for (const size_t depth: {1, 3}) {
+         for (unsigned seed = 0; seed < 30; ++seed) {
+            const workload w = random_workload(seed, 6, 30);
+            transaction_db db(w.accounts);
+            db.set_settle_mode(settle_mode::beam);
+            db.set_beam(width, depth);
+            for (const auto& t: w.transactions) {
+               db.push_transaction(t);
+            }
+            db.settle();
+            expect_valid(db, w);
+         }
+      }
+   }
+}
+
+TEST(beam_settle, needs_width_and_depth)
+{
+   transaction_db db(pays_later.accounts);
+   EXPECT_THROW(db.set_beam(0, 3), std::invalid_argument);
+   EXPECT_THROW(db.set_beam(4, 0), std::invalid_argument);
+}
+
+static const greedy_score all_scores[] = {greedy_score::invalid_accounts, greedy_score::deficit,
+                                          greedy_score::repair_per_volume, greedy_score::fewest_transfers};
+
+static transaction_db settled_greedy(const workload& w, const greedy_score score, const size_t threads)
+{
+   transaction_db db(w.accounts);
+   db.set_greedy_score(score);
+   db.set_settle_threads(threads, 1);
+   for (const auto& t: w.transactions) {
+      db.push_transaction(t);
+   }
+   db.settle();
+   return db;
+}
+
+TEST(greedy_settle, every_score_leaves_no_negatives)
+{
+   for (const greedy_score score: all_scores) {
+      for (unsigned seed = 0; seed < 30; ++seed) {
+         const workload w = random_workload(seed, 6, 30);
+         expect_valid(settled_greedy(w, score, 1), w);
+      }
+   }
+}
+
+/**
+ * Scoring on the pool ranks the candidates the same way, so it has to pick the same victims.
+ */
+TEST(greedy_settle, parallel_scoring_matches_serial)
+{
+   for (const greedy_score score: all_scores) {
+      for (unsigned seed = 0; seed < 20; ++seed) {
+         const workload w = random_workload(seed, 8, 40);
+         EXPECT_EQ(settled_greedy(w, score, 3).get_applied_transactions(),
+                   settled_greedy(w, score, 1).get_applied_transactions())
+            << "seed " << seed;
+      }
+   }
+}
+
+/**
+ * The greedy settle as one plain loop over the whole batch: roll back whichever transaction touching a negative
+ * account leaves the fewest negative accounts, the oldest on ties, until nothing is negative.
+ * @return ids of the transactions kept.
+ */
+static vector<size_t> reference_greedy(const workload& w)
+{
+   vector<long long> balances;
+   for (const auto& a: w.accounts) {
+      balances.push_back(a.balance);
+   }
+   vector<bool> kept(w.transactions.size(), true);
+   const auto move = [&balances](const transaction& t, const long long sign) {
+      for (const auto& x: t) {
+         balances[x.from] -= sign * x.amount;
+         balances[x.to] += sign * x.amount;
+      }
+   };
+   const auto negatives = [&balances]() {
+      size_t count = 0;
+      for (const long long b: balances) {
+         count += b < 0;
+      }
+      return count;
+   };
+   for (const auto& t: w.transactions) {
+      move(t, 1);
+   }
+
+   while (negatives() > 0) {
+      size_t victim = w.transactions.size();
+      size_t best = 0;
+      for (size_t id = 0; id < w.transactions.size(); ++id) {
+         bool touches = false;
+         for (const auto& x: w.transactions[id]) {
+            touches = touches || balances[x.from] < 0 || balances[x.to] < 0;
+         }
+         if (!kept[id] || !touches) {
+            continue;
+         }
+         move(w.transactions[id], -1);
+         const size_t left = negatives();
+         move(w.transactions[id], 1);
+         if (victim == w.transactions.size() || left < best) {
+            victim = id;
+            best = left;
+         }
+      }
+      move(w.transactions[victim], -1);
+      kept[victim] = false;
+   }
+
+   vector<size_t> applied;
+   for (size_t id = 0; id < kept.size(); ++id) {
+      if (kept[id]) {
+         applied.push_back(id);
+      }
+   }
+   return applied;
+}
+
+TEST(greedy_settle, matches_reference_loop)
+{
+   for (unsigned seed = 0; seed < 50; ++seed) {
+      const workload w = random_workload(seed, 8, 40);
+      const vector<size_t> expected = reference_greedy(w);
+      EXPECT_EQ(settled_greedy(w, greedy_score::invalid_accounts, 1).get_applied_transactions(), expected) << "seed " << seed;
+      EXPECT_EQ(settled_greedy(w, greedy_score::invalid_accounts, 3).get_applied_transactions(), expected) << "seed " << seed;
+   }
+}
+
+/**
+ * Accounts 1 to 3 only see transactions that settle on their own: 1 overdraws unless one of its two payments goes.
+ * Account 4 starts negative and no transaction touches it. Account 5 starts negative too and pays 6, which passes
+ * money on to 7, so nothing pending can fix that scope.
+ */
+static const vector<account_balance> initial = {{1, 5}, {2, 0}, {3, 0}, {4, -3}, {5, -2}, {6, 10}, {7, 0}};
+static const vector<transaction> healthy = {{{1, 2, 4}}, {{1, 3, 3}}, {{2, 3, 1}}};
+static const vector<transaction> broken = {{{5, 6, 1}}, {{6, 7, 2}}};
+
+/**
+ * Settles healthy alone, or healthy and then broken, in mode. settle_deadline settles with a deadline instead.
+ */
+static transaction_db settled_split(const settle_mode mode, const bool with_broken, const bool settle_deadline = false)
+{
+   transaction_db db(initial);
+   db.set_settle_mode(mode);
+   for (const auto& t: healthy) {
+      db.push_transaction(t);
+   }
+   if (with_broken) {
+      for (const auto& t: broken) {
+         db.push_transaction(t);
+      }
+   }
+   if (settle_deadline) {
+      db.settle(chrono::steady_clock::now() + chrono::milliseconds(10));
+   } else {
+      db.settle();
+   }
+   return db;
+}
+
+static void expect_unrepairable_scope_only(const transaction_db& with, const transaction_db& alone)
+{
+   // the healthy scope settles the same with or without the broken one next to it
+   vector<size_t> applied = with.get_applied_transactions();
+   const bool paid_6 = std::find(applied.begin(), applied.end(), 3) != applied.end();
+   const bool paid_7 = std::find(applied.begin(), applied.end(), 4) != applied.end();
+   applied.erase(std::remove_if(applied.begin(), applied.end(), [](const size_t id) { return id >= healthy.size(); }), applied.end());
+   EXPECT_EQ(applied, alone.get_applied_transactions());
+   EXPECT_FALSE(applied.empty());
+
+   const vector<account_balance> balances = with.get_balances();
+   const vector<account_balance> expected = alone.get_balances();
+   ASSERT_EQ(balances.size(), expected.size());
+   for (size_t i = 0; i < 3; ++i) {
+      EXPECT_EQ(balances[i].balance, expected[i].balance) << "account " << balances[i].account_id;
+   }
+
+   // the broken scope keeps what it settled on, 6 paying 7 is fine whatever happens to 5. What nothing touches and
+   // what nothing can fix stay negative
+   EXPECT_TRUE(paid_7);
+   EXPECT_EQ(balances[3].balance, -3);
+   EXPECT_LT(balances[4].balance, 0);
+   EXPECT_EQ(balances[5].balance, 10 + (paid_6 ? 1 : 0) - (paid_7 ? 2 : 0));
+   EXPECT_EQ(balances[6].balance, paid_7 ? 2 : 0);
+}
+
+class unrepairable_scope: public ::testing::TestWithParam<settle_mode> {};
+
+TEST_P(unrepairable_scope, leaves_other_scopes_alone)
+{
+   expect_unrepairable_scope_only(settled_split(GetParam(), true), settled_split(GetParam(), false));
+}
+
+INSTANTIATE_TEST_SUITE_P(settle_modes, unrepairable_scope,
+                         ::testing::Values(settle_mode::greedy, settle_mode::branch_and_bound, settle_mode::forward,
+                                           settle_mode::beam));
+
+TEST(unrepairable_scope_anytime, leaves_other_scopes_alone)
+{
+   expect_unrepairable_scope_only(settled_split(settle_mode::greedy, true, true), settled_split(settle_mode::greedy, false, true));
+}
+
+TEST(unrepairable_scope_threads, leaves_other_scopes_alone)
+{
+   transaction_db db(initial);
+   db.set_settle_threads(3, 1);
+   for (const auto& t: healthy) {
+      db.push_transaction(t);
+   }
+   for (const auto& t: broken) {
+      db.push_transaction(t);
+   }
+   db.settle();
+   expect_unrepairable_scope_only(db, settled_split(settle_mode::greedy, false));
+}
@@ -0,0 +1,121 @@
+#include "text_reader.hpp"
+
+#include <limits>
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+text_reader::text_reader(const char* path): file(path), cursor(file.data()), last(file.data() + file.size())
+{
+}
+
+/**
+ * Reads the account count, then one account per line.
+ */
+vector<account_balance> text_reader::read_accounts()
+{
+   const long long count = next_number();
+   skip_line();
+
+   vector<account_balance> accounts;
+   accounts.reserve(count > 0 ? static_cast<size_t>(count) : 0);
+   for (long long i = 0; i < count; ++i) {
+      const long long account = next_number();
+      const long long balance = next_number();
+      skip_line();
+
+      accounts.push_back({static_cast<int>(account), static_cast<int>(balance)});
+   }
+   return accounts;
+}
+
+size_t text_reader::read_transaction_count()
+{
+   const long long count = next_number();
+   skip_line();
+   return count > 0 ? static_cast<size_t>(count) : 0;
+}
+
+/**
+ * Reads the transfer count, then one transfer per line.
+ */
+void text_reader::read_transaction(transaction& t)
+{
+   t.clear();
+
+   const long long count = next_number();
+   skip_line();
+   for (long long i = 0; i < count; ++i) {
+      const long long from = next_number();
+      const long long to = next_number();
+      const long long amount = next_number();
+      skip_line();
+
+      t.push_back({static_cast<int>(from), static_cast<int>(to), static_cast<int>(amount)});
+   }
+}
+
+vector<size_t> text_reader::read_applied_transactions()
+{
+   const long long count = next_number();
+   skip_line();
+
+   vector<size_t> applied;
+   applied.reserve(count > 0 ? static_cast<size_t>(count) : 0);
+   for (long long i = 0; i < count; ++i) {
+      const long long id = next_number();
+      skip_line();
+
+      if (id < 0) {
+         throw std::runtime_error("Negative transaction id.");
+      }
+      applied.push_back(static_cast<size_t>(id));
+   }
+   return applied;
+}
+
+/**
+ * Hand rolled instead of strtol: the mapping isn't null terminated, and there is no locale or errno handling to pay for.
+ * Digits are checked with a single unsigned compare.
+ */
+long long text_reader::next_number()
+{
+   while (cursor != last && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')) {
+      ++cursor;
+   }
+   if (cursor == last) {
+      throw std::runtime_error("Unexpected end of input.");
+   }
+
+   const bool negative = (*cursor == '-');
+   if (negative || *cursor == '+') {
+      ++cursor;
+   }
+   if (cursor == last || static_cast<unsigned char>(*cursor - '0') > 9) {
+      throw std::runtime_error("Expected a number.");
+   }
+
+   long long value = 0;
+   while (cursor != last && static_cast<unsigned char>(*cursor - '0') <= 9) {
+      value = value * 10 + (*cursor - '0');
+      if (value > std::numeric_limits<int>::max() + 1LL) {
+         throw std::runtime_error("Number out of range.");
+      }
+      ++cursor;
+   }
+
+   value = negative ? -value : value;
+   if (value > std::numeric_limits<int>::max()) {
+      throw std::runtime_error("Number out of range.");
+   }
+   return value;
+}
+
+/**
+ * memchr is vectorized by the C library, so long trailing comments cost next to nothing.
+ */
+void text_reader::skip_line()
+{
+   const void* newline = std::memchr(cursor, '\n', last - cursor);
+   cursor = newline ? static_cast<const char*>(newline) + 1 : last;
+}
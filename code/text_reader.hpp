@@ -0,0 +1,70 @@
+#ifndef TEXT_READER_HPP
+#define TEXT_READER_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "transaction_db.hpp"
+
+/**
+ * @brief Parses the text input format straight out of a memory mapped file.
+ *
+ *        Format:
+ *           <number of accounts>
+ *           <account_id> <balance>            (once per account)
+ *           <number of transactions>
+ *           <number of transfers>              (once per transaction, followed by its transfers)
+ *           <from> <to> <amount>               (once per transfer)
+ *
+ *        Same rules as reading with operator>> followed by ignore(..., '\n'): the numbers of a record are read, then the
+ *        rest of its line is skipped. Numbers are parsed directly from the mapped bytes, nothing is copied into a stream buffer.
+ *
+ *        Must be read in order: read_accounts(), read_transaction_count(), then read_transaction() that many times.
+ *        A result file (out.txt) is read with read_applied_transactions() followed by read_accounts().
+ *        Every read throws std::runtime_error on malformed or truncated input.
+ */
+class text_reader {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be opened or mapped.
+    */
+   explicit text_reader(const char* path);
+
+   /**
+    * @return the initial balances at the start of the file.
+    */
+   std::vector<account_balance> read_accounts();
+
+   /**
+    * @return number of transactions that follow.
+    */
+   size_t read_transaction_count();
+
+   /**
+    * @brief Reads the next transaction into t. t is cleared first and reused, so its capacity carries over between calls.
+    */
+   void read_transaction(transaction& t);
+
+   /**
+    * @return the applied transaction ids at the start of a result file, one per line after their count.
+    */
+   std::vector<size_t> read_applied_transactions();
+
+private:
+   mapped_file file;
+   const char* cursor; ///< next byte to parse
+   const char* last;   ///< one past the end of the file
+
+   /**
+    * @return the next integer, skipping any whitespace before it.
+    */
+   long long next_number();
+
+   /**
+    * @brief Moves cursor past the next newline, or to the end of the file.
+    */
+   void skip_line();
+};
+
+#endif // TEXT_READER_HPP
@@ -0,0 +1,46 @@
+#include "text_writer.hpp"
+
+#include <string>
+#include <stdexcept>
+using namespace std;
+
+/**
+ * '\n' instead of endl throughout, flushing every line would dominate the cost of big files.
+ */
+text_writer::text_writer(const char* path, array_view<const account_balance> accounts, size_t transaction_count):
+   fout(path), remaining(transaction_count)
+{
+   if (!fout) {
+      throw std::runtime_error(string("Could not create ") + path);
+   }
+
+   fout << accounts.size() << '\n';
+   for (const auto& cur : accounts) {
+      fout << cur.account_id << " " << cur.balance << '\n';
+   }
+   fout << transaction_count << '\n';
+}
+
+void text_writer::write_transaction(array_view<const transfer> t)
+{
+   if (remaining == 0) {
+      throw std::logic_error("More transactions written than announced.");
+   }
+   --remaining;
+
+   fout << t.size() << '\n';
+   for (const auto& cur : t) {
+      fout << cur.from << " " << cur.to << " " << cur.amount << '\n';
+   }
+}
+
+void text_writer::close()
+{
+   fout.close();
+   if (!fout) {
+      throw std::runtime_error("Could not write the text input.");
+   }
+   if (remaining != 0) {
+      throw std::logic_error("Fewer transactions written than announced.");
+   }
+}
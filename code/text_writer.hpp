@@ -0,0 +1,33 @@
+#ifndef TEXT_WRITER_HPP
+#define TEXT_WRITER_HPP
+
+#include <cstddef>
+#include <fstream>
+
+#include "transaction_db.hpp"
+
+/**
+ * @brief Writes the text input format read by text_reader. Counterpart of binary_writer: the transaction count goes in
+ *        up front so transactions can be streamed through write_transaction(), and close() checks the count was honored.
+ */
+class text_writer {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be created.
+    */
+   text_writer(const char* path, array_view<const account_balance> accounts, size_t transaction_count);
+
+   void write_transaction(array_view<const transfer> t);
+
+   /**
+    * @brief Flushes and closes the file.
+    * @throw std::runtime_error If a write failed or the wrong number of transactions was written.
+    */
+   void close();
+
+private:
+   std::ofstream fout;
+   size_t remaining; ///< transactions still owed
+};
+
+#endif // TEXT_WRITER_HPP
@@ -0,0 +1,95 @@
+#include "thread_pool.hpp"
+
+using namespace std;
+
+thread_pool::thread_pool(const size_t threads): job(nullptr), job_tasks(0), next_task(0), remaining(0), generation(0), active(0), stopping(false)
+{
+   for (size_t i = 1; i < threads; ++i) {
+      workers.emplace_back([this]() { work(); });
+   }
+}
+
+thread_pool::~thread_pool()
+{
+   {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (auto& t : workers) {
+      t.join();
+   }
+}
+
+/**
+ * A run only starts and ends with no worker inside the previous one, so job and job_tasks are never written while a
+ * worker reads them. Workers that wake up late simply find no tasks left.
+ */
+void thread_pool::run(const size_t tasks, const function<void(size_t)>& task)
+{
+   if (workers.empty() || tasks <= 1) {
+      for (size_t i = 0; i < tasks; ++i) {
+         task(i);
+      }
+      return;
+   }
+
+   {
+      unique_lock<mutex> guard(lock);
+      idle.wait(guard, [this]() { return active == 0; });
+      job = &task;
+      job_tasks = tasks;
+      next_task.store(0, memory_order_relaxed);
+      remaining.store(tasks, memory_order_relaxed);
+      ++generation;
+   }
+   wake.notify_all();
+
+   drain(task, tasks);
+
+   unique_lock<mutex> guard(lock);
+   idle.wait(guard, [this]() { return remaining.load(memory_order_acquire) == 0 && active == 0; });
+   job = nullptr;
+}
+
+void thread_pool::work()
+{
+   uint64_t joined = 0;
+   for (;;) {
+      const function<void(size_t)>* task;
+      size_t tasks;
+      {
+         unique_lock<mutex> guard(lock);
+         wake.wait(guard, [&]() { return stopping || generation != joined; });
+         if (stopping) {
+            return;
+         }
+         joined = generation;
+         if (!job) {
+            continue; // woke up after the run already finished
+         }
+         task = job;
+         tasks = job_tasks;
+         ++active;
+      }
+
+      drain(*task, tasks);
+
+      {
+         lock_guard<mutex> guard(lock);
+         --active;
+      }
+      idle.notify_all();
+   }
+}
+
+void thread_pool::drain(const function<void(size_t)>& task, const size_t tasks)
+{
+   for (size_t i = next_task.fetch_add(1, memory_order_relaxed); i < tasks; i = next_task.fetch_add(1, memory_order_relaxed)) {
+      task(i);
+      if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+         lock_guard<mutex> guard(lock);
+         idle.notify_all();
+      }
+   }
+}
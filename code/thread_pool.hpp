@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+/**
+ * @brief Fixed set of worker threads for fork-join loops. run() hands out task indices from an atomic counter,
+ *        the calling thread works too, and it returns once every task is done.
+ *
+ *        Built for settle, which forks once per round: workers sleep on a condition variable between runs,
+ *        so an idle pool costs nothing.
+ */
+class thread_pool {
+public:
+   /**
+    * @param threads Threads that work on a run, counting the caller. threads - 1 workers are started.
+    */
+   explicit thread_pool(const size_t threads);
+   ~thread_pool();
+
+   thread_pool(const thread_pool&) = delete;
+   thread_pool& operator=(const thread_pool&) = delete;
+
+   /**
+    * @return threads working on a run, counting the caller.
+    */
+   size_t size() const { return workers.size() + 1; }
+
+   /**
+    * @brief Calls task(i) for every i in [0, tasks), spread over the pool. Blocks until all of them returned.
+    *        Not reentrant: task must not call run() on the same pool.
+    */
+   void run(const size_t tasks, const std::function<void(size_t)>& task);
+
+private:
+   std::vector<std::thread> workers;
+   std::mutex lock;
+   std::condition_variable wake;  ///< signaled when a run starts or the pool stops
+   std::condition_variable idle;  ///< signaled when the last task finishes or a worker leaves a run
+
+   const std::function<void(size_t)>* job; ///< task of the current run
+   size_t job_tasks;                       ///< number of tasks in the current run
+   std::atomic<size_t> next_task;          ///< next index to hand out
+   std::atomic<size_t> remaining;          ///< tasks of the current run that haven't finished
+   std::uint64_t generation;               ///< bumped by every run, workers compare it to the last one they joined
+   size_t active;                          ///< workers inside the current run
+   bool stopping;
+
+   void work();
+   void drain(const std::function<void(size_t)>& task, const size_t tasks);
+};
+
+#endif // THREAD_POOL_HPP
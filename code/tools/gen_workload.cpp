@@ -0,0 +1,122 @@
+/**
+ * Writes a synthetic workload in the text or binary input format. Build with `make tools`.
+ *
+ *    ./gen_workload.out --preset=example4 --transactions=100000 --seed=7 --output=example4.txt
+ *    ./gen_workload.out --accounts=50000 --zipf=1.1 --overdraft=0.02 --format=binary --output=hot.bin
+ *
+ * Options are applied in order, so a preset comes first and the options after it override its values.
+ */
+#include "workload_generator.hpp"
+#include "binary_format.hpp"
+#include "text_writer.hpp"
+
+#include <string>
+#include <cstdlib>
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+using namespace std;
+
+static void usage(const char* name)
+{
+   cerr << "usage: " << name << " [--preset=uniform|hot|overdraft|example4] [--accounts=N] [--balance=N] [--transactions=N]\n"
+        << "       [--transfers=N] [--max-amount=N] [--zipf=S] [--overdraft=F] [--chains=F] [--chain-length=N]\n"
+        << "       [--chain-spread=N] [--seed=N] [--format=text|binary] [--output=PATH]" << endl;
+}
+
+/**
+ * @return the value of arg if it starts with name, e.g. "--seed=", otherwise nullptr.
+ */
+static const char* option(const string& arg, const char* name)
+{
+   const size_t length = char_traits<char>::length(name);
+   return arg.compare(0, length, name) == 0 ? arg.c_str() + length : nullptr;
+}
+
+static unsigned long long to_unsigned(const char* value)
+{
+   char* end = nullptr;
+   const unsigned long long n = strtoull(value, &end, 10);
+   if (*value == '\0' || *end != '\0' || *value == '-') {
+      throw invalid_argument(string("Expected a number, got ") + value);
+   }
+   return n;
+}
+
+static double to_double(const char* value)
+{
+   char* end = nullptr;
+   const double d = strtod(value, &end);
+   if (*value == '\0' || *end != '\0') {
+      throw invalid_argument(string("Expected a number, got ") + value);
+   }
+   return d;
+}
+
+int main(int argc, char* argv[])
+{
+   try {
+      workload_options options;
+      string output_path = "workload.txt";
+      bool binary = false;
+
+      for (int i = 1; i < argc; ++i) {
+         const string arg = argv[i];
+         const char* value = nullptr;
+         if ((value = option(arg, "--preset="))) {
+            options = workload_preset(value);
+         } else if ((value = option(arg, "--accounts="))) {
+            options.accounts = to_unsigned(value);
+         } else if ((value = option(arg, "--balance="))) {
+            options.initial_balance = static_cast<int>(to_unsigned(value));
+         } else if ((value = option(arg, "--transactions="))) {
+            options.transactions = to_unsigned(value);
+         } else if ((value = option(arg, "--transfers="))) {
+            options.transfers_per_transaction = to_unsigned(value);
+         } else if ((value = option(arg, "--max-amount="))) {
+            options.max_amount = static_cast<int>(to_unsigned(value));
+         } else if ((value = option(arg, "--zipf="))) {
+            options.zipf_skew = to_double(value);
+         } else if ((value = option(arg, "--overdraft="))) {
+            options.overdraft_fraction = to_double(value);
+         } else if ((value = option(arg, "--chains="))) {
+            options.chain_fraction = to_double(value);
+         } else if ((value = option(arg, "--chain-length="))) {
+            options.chain_length = to_unsigned(value);
+         } else if ((value = option(arg, "--chain-spread="))) {
+            options.chain_spread = to_unsigned(value);
+         } else if ((value = option(arg, "--seed="))) {
+            options.seed = to_unsigned(value);
+         } else if (arg == "--format=text") {
+            binary = false;
+         } else if (arg == "--format=binary") {
+            binary = true;
+         } else if ((value = option(arg, "--output="))) {
+            output_path = value;
+         } else {
+            usage(argv[0]);
+            return -1;
+         }
+      }
+
+      const workload w = generate_workload(options);
+      if (binary) {
+         binary_writer writer(output_path.c_str(), w.accounts, w.transactions.size());
+         for (const auto& t : w.transactions) {
+            writer.write_transaction(t);
+         }
+         writer.close();
+      } else {
+         text_writer writer(output_path.c_str(), w.accounts, w.transactions.size());
+         for (const auto& t : w.transactions) {
+            writer.write_transaction(t);
+         }
+         writer.close();
+      }
+   } catch (std::exception& e) {
+      cerr << e.what() << endl;
+      return -1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,2182 @@
+#include "transaction_db.hpp"
+#include "write_ahead_log.hpp"
+#include "checkpoint.hpp"
+#include "state_view.hpp"
+#include "concurrent_ingest.hpp"
+#include "indexed_heap.hpp"
+
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <iterator>
+
+#include <unistd.h>
+using namespace std;
+
+/**
+ * Bumps cursor forward. When the current block can't fit the request, moves on to the next block that can,
+ * allocating a new one only when the existing blocks are exhausted.
+ */
+void* log_arena::allocate(const size_t bytes, const size_t align)
+{
+   while (true) {
+      if (cursor) {
+         const size_t misalignment = reinterpret_cast<std::uintptr_t>(cursor) % align;
+         char* aligned = misalignment ? cursor + (align - misalignment) : cursor;
+         if (aligned + bytes <= limit) {
+            cursor = aligned + bytes;
+            return aligned;
+         }
+         ++current;
+      }
+
+      // every block has been used, so add one big enough for this request
+      if (current >= blocks.size()) {
+         const size_t size = std::max(block_size, bytes + align);
+         blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+         current = blocks.size() - 1;
+      }
+
+      cursor = blocks[current].memory.get();
+      limit = cursor + blocks[current].size;
+   }
+}
+
+/**
+ * Keeps every block, only rewinds to the start of the first one.
+ */
+void log_arena::reset()
+{
+   current = 0;
+   cursor = blocks.empty() ? nullptr : blocks.front().memory.get();
+   limit = blocks.empty() ? nullptr : cursor + blocks.front().size;
+}
+
+/**
+ * The blocks other used go in front of the current block, so allocate() counts them as full until the next reset().
+ * The ones it never got to go at the back, free.
+ */
+void log_arena::adopt(log_arena& other)
+{
+   const size_t used = other.cursor ? other.current + 1 : 0;
+   blocks.insert(blocks.begin() + current, std::make_move_iterator(other.blocks.begin()),
+                 std::make_move_iterator(other.blocks.begin() + used));
+   current += used;
+   blocks.insert(blocks.end(), std::make_move_iterator(other.blocks.begin() + used), std::make_move_iterator(other.blocks.end()));
+
+   other.blocks.clear();
+   other.reset();
+}
+
+/**
+ * Subtracts xfer.balance from xfer.from and adds xfer.balance to xfer.to.
+ * This function is ran after it is verified that the accounts in the transfer exist in the database.
+ */
+void transaction_log::add_to_log(const transfer& xfer)
+{
+   add_change(xfer.from, -xfer.amount);
+   add_change(xfer.to, xfer.amount);
+}
+
+/**
+ * Binary searches for account_id. If it exists then change is added to it, otherwise a new entry is shifted into place.
+ * The log moves to spilled_log the first time it grows past inline_capacity.
+ */
+void transaction_log::add_change(const int account_id, const int change)
+{
+   account_balance* first = data();
+   account_balance* last = first + count;
+   account_balance* it = std::lower_bound(first, last, account_id,
+                                          [](const account_balance& x, int id) { return x.account_id < id; });
+
+   // already exists, so just update it
+   if (it != last && it->account_id == account_id) {
+      it->balance += change;
+      return;
+   }
+
+   const size_t pos = it - first;
+   if (count < inline_capacity) {
+      std::copy_backward(it, last, last + 1);
+      *it = {account_id, change};
+   } else {
+      if (count == inline_capacity) {
+         spilled_log.reserve(2 * inline_capacity);
+         spilled_log.assign(inline_log, inline_log + count);
+      }
+      spilled_log.insert(spilled_log.begin() + pos, {account_id, change});
+   }
+   ++count;
+}
+
+/**
+ * @return entry for account_id, end() if it isn't in the log.
+ */
+transaction_log::const_iterator transaction_log::find(const int account_id) const
+{
+   auto it = std::lower_bound(begin(), end(), account_id,
+                              [](const account_balance& x, int id) { return x.account_id < id; });
+   return (it != end() && it->account_id == account_id) ? it : end();
+}
+
+/**
+ * @return the net change for an account if it exists, 0 otherwise.
+ */
+int transaction_log::net_change(const int account_id) const
+{
+   auto it = find(account_id);
+   if (it != end()) {
+      return it->balance;
+   } else {
+      return 0;
+   }
+}
+
+
+
+constexpr size_t transaction_log::inline_capacity;
+constexpr size_t exact_settler::npos;
+constexpr size_t transaction_db::npos;
+constexpr size_t transaction_db::default_parallel_candidates;
+constexpr size_t transaction_db::default_wal_group_bytes;
+constexpr size_t transaction_db::default_max_readers;
+constexpr size_t transaction_db::default_forward_window;
+constexpr size_t transaction_db::default_beam_width;
+constexpr size_t transaction_db::default_beam_depth;
+constexpr size_t transaction_db::default_exact_node_limit;
+
+/**
+ * Maps every account touched by a pending transaction to a local index and records which transactions withdrew from it.
+ */
+exact_settler::exact_settler(const std::vector<const transaction_log*>& logs, const std::function<int(int account_id)>& balance_of,
+                             const size_t node_limit):
+                             log_entries(logs.size()), total_repair(logs.size(), 0), state(logs.size(), decision::undecided),
+                             next_scope(1), nodes(0), node_limit(node_limit), claimed(logs.size(), 0), stamp(0), parent(logs.size())
+{
+   std::unordered_map<int, size_t> local; // account_id -> local index
+
+   for (size_t i = 0; i < logs.size(); ++i) {
+      for (const auto& x: *logs[i]) {
+         const int account_id = x.account_id;
+         auto it = local.find(account_id);
+         if (it == local.end()) {
+            it = local.emplace(account_id, balances.size()).first;
+            balances.push_back(balance_of(account_id));
+            helpers.emplace_back();
+         }
+
+         const int change = x.balance;
+         log_entries[i].push_back({it->second, change});
+         if (change < 0) {
+            helpers[it->second].push_back({i, -change});
+            total_repair[i] -= change;
+         }
+      }
+   }
+
+   // trying the biggest repairs first finds a good solution early, which makes pruning more effective
+   for (auto& h: helpers) {
+      std::sort(h.begin(), h.end(), [](const auto& a, const auto& b) { return a.repair > b.repair; });
+   }
+
+   scope_of.assign(balances.size(), 0);
+   credit.assign(balances.size(), 0);
+   owner.assign(balances.size(), npos);
+   negative_pos.assign(balances.size(), npos);
+   left_out.assign(balances.size(), 0);
+   for (size_t a = 0; a < balances.size(); ++a) {
+      update_negative(a);
+   }
+}
+
+/**
+ * Searches for the fewest drops. Anything short of dropping everything is an improvement,
+ * so that is the starting limit.
+ *
+ * An account that is still negative with every transaction taking money out of it dropped can't be repaired, so it is
+ * left out before searching. What is left can still fail together, say an account only a payment into it repairs,
+ * while the payer needs that payment dropped. Dropping everything puts every account back where it was before the
+ * pending transactions, so leaving out the accounts that were negative there too always has a solution.
+ */
+std::vector<bool> exact_settler::solve()
+{
+   // the scope is kept sorted by largest total repair first, lower_bound() relies on it
+   std::vector<size_t> scope(log_entries.size());
+   std::iota(scope.begin(), scope.end(), 0);
+   std::stable_sort(scope.begin(), scope.end(), [this](size_t a, size_t b) { return total_repair[a] > total_repair[b]; });
+
+   std::vector<long long> repaired(balances);  // every withdrawal dropped
+   std::vector<long long> settled(balances);   // every transaction dropped
+   for (const auto& entries: log_entries) {
+      for (const auto& e: entries) {
+         settled[e.account] -= e.change;
+         repaired[e.account] -= std::min(e.change, 0);
+      }
+   }
+   for (size_t a = 0; a < balances.size(); ++a) {
+      if (repaired[a] < 0) {
+         leave_out(a);
+      }
+   }
+
+   std::vector<size_t> dropped;
+   if (search(scope, 0, log_entries.size() + 1, dropped) == npos && !ran_out_of_nodes()) {
+      for (size_t a = 0; a < balances.size(); ++a) {
+         if (settled[a] < 0) {
+            leave_out(a);
+         }
+      }
+      search(scope, 0, log_entries.size() + 1, dropped);
+   }
+
+   // whatever an unfinished search left in dropped isn't a solution
+   if (ran_out_of_nodes()) {
+      dropped.clear();
+   }
+
+   std::vector<bool> result(log_entries.size(), false);
+   for (const size_t log: dropped) {
+      result[log] = true;
+   }
+   return result;
+}
+
+/**
+ * Depth first search over drop sets. See the class description for the branching, bounding and splitting rules.
+ *
+ * @param scope   Transactions in this sub problem, sorted by largest total repair first. Decided ones are skipped.
+ * @param id      Id of this sub problem. Negative accounts belonging to it have scope_of set to id.
+ * @param limit   Only solutions with fewer than limit drops are wanted.
+ * @param dropped Filled with the transactions to drop when a solution is found.
+ * @return number of drops in the best solution, npos if there isn't one under limit or the nodes ran out.
+ */
+size_t exact_settler::search(const std::vector<size_t>& scope, const size_t id, const size_t limit, std::vector<size_t>& dropped)
+{
+   if (++nodes > node_limit) {
+      return npos;
+   }
+   const size_t needed = lower_bound(scope, id);
+   if (needed == 0) {
+      dropped.clear();
+      return 0;
+   }
+   if (needed == npos || needed >= limit) {
+      return npos;
+   }
+
+   std::vector<std::vector<size_t>> parts;
+   split(scope, parts);
+
+   // solve every independent group on its own and add the results up
+   if (parts.size() > 1 || parts.front().size() < scope.size()) {
+      std::vector<size_t> ids(parts.size());
+      std::vector<size_t> bounds(parts.size());
+      size_t bound_sum = 0;
+      for (size_t i = 0; i < parts.size(); ++i) {
+         ids[i] = next_scope++;
+         for (const size_t log: parts[i]) {
+            for (const auto& e: log_entries[log]) {
+               scope_of[e.account] = ids[i];
+            }
+         }
+      }
+      for (size_t i = 0; i < parts.size(); ++i) {
+         bounds[i] = lower_bound(parts[i], ids[i]);
+         bound_sum += bounds[i];
+      }
+
+      size_t total = npos;
+      if (bound_sum < limit) {
+         total = 0;
+         dropped.clear();
+         std::vector<size_t> part_dropped;
+         for (size_t i = 0; i < parts.size(); ++i) {
+            // leave room for what the remaining groups need at least
+            bound_sum -= bounds[i];
+            const size_t found = search(parts[i], ids[i], limit - total - bound_sum, part_dropped);
+            if (found == npos) {
+               total = npos;
+               break;
+            }
+            total += found;
+            dropped.insert(dropped.end(), part_dropped.begin(), part_dropped.end());
+         }
+      }
+
+      for (const size_t log: scope) {
+         for (const auto& e: log_entries[log]) {
+            scope_of[e.account] = id;
+         }
+      }
+      return total;
+   }
+
+   // branch on the negative account with the fewest undecided helpers so the tree stays narrow
+   size_t account = npos;
+   size_t fewest = npos;
+   for (const size_t a: negatives) {
+      if (scope_of[a] != id) {
+         continue;
+      }
+
+      size_t count = 0;
+      for (const auto& h: helpers[a]) {
+         count += (state[h.log] == decision::undecided);
+      }
+      if (count < fewest) {
+         fewest = count;
+         account = a;
+      }
+   }
+
+   std::vector<size_t> branches;
+   branches.reserve(fewest);
+   for (const auto& h: helpers[account]) {
+      if (state[h.log] == decision::undecided) {
+         branches.push_back(h.log);
+      }
+   }
+
+   size_t best = npos;
+   size_t best_limit = limit;
+   std::vector<size_t> branch_dropped;
+   for (const size_t log: branches) {
+      drop(log);
+      const size_t found = search(scope, id, best_limit - 1, branch_dropped);
+      undrop(log);
+
+      if (found != npos) {
+         best = found + 1;
+         best_limit = best;
+         dropped.swap(branch_dropped);
+         dropped.push_back(log);
+
+         // can't do better than the bound
+         if (best == needed) {
+            break;
+         }
+      }
+
+      // later branches keep this transaction, otherwise the same drop set would be searched again
+      state[log] = decision::keep;
+   }
+
+   for (const size_t log: branches) {
+      state[log] = decision::undecided;
+   }
+   return best;
+}
+
+/**
+ * @return fewest additional drops needed to fix every negative account in the sub problem, or npos if it can't be fixed.
+ *         Ignores the harm a drop does to the accounts it paid into, which keeps the estimate admissible.
+ */
+size_t exact_settler::lower_bound(const std::vector<size_t>& scope, const size_t id)
+{
+   long long total_deficit = 0;
+   required.clear();
+
+   // fewest helpers that can cover each account on its own
+   for (const size_t a: negatives) {
+      if (scope_of[a] != id) {
+         continue;
+      }
+
+      const long long deficit = -balances[a];
+      total_deficit += deficit;
+
+      long long repaired = 0;
+      size_t count = 0;
+      for (const auto& h: helpers[a]) {
+         if (repaired >= deficit) {
+            break;
+         }
+         if (state[h.log] == decision::undecided) {
+            repaired += h.repair;
+            ++count;
+         }
+      }
+
+      if (repaired < deficit) {
+         return npos;
+      }
+      required.emplace_back(count, a);
+   }
+
+   // add up accounts whose undecided helpers don't overlap, starting with the most demanding ones
+   std::sort(required.begin(), required.end(), std::greater<std::pair<size_t, size_t>>());
+   ++stamp;
+   size_t needed = 0;
+   for (const auto& r: required) {
+      const auto& h = helpers[r.second];
+      const bool disjoint = std::none_of(h.begin(), h.end(), [this](const helper& x) {
+         return state[x.log] == decision::undecided && claimed[x.log] == stamp;
+      });
+
+      if (disjoint) {
+         for (const auto& x: h) {
+            claimed[x.log] = stamp;
+         }
+         needed += r.first;
+      }
+   }
+
+   // fewest transactions that can cover the total deficit
+   long long repaired = 0;
+   size_t count = 0;
+   for (const size_t log: scope) {
+      if (repaired >= total_deficit) {
+         break;
+      }
+      if (state[log] == decision::undecided) {
+         repaired += total_repair[log];
+         ++count;
+      }
+   }
+
+   return std::max(needed, count);
+}
+
+/**
+ * Groups the undecided transactions in scope by the unsafe accounts they share.
+ * Only groups containing a negative account are returned, everything else can be kept as is.
+ * Groups keep the order of scope.
+ */
+void exact_settler::split(const std::vector<size_t>& scope, std::vector<std::vector<size_t>>& parts)
+{
+   for (const size_t log: scope) {
+      if (state[log] == decision::undecided) {
+         for (const auto& e: log_entries[log]) {
+            if (e.change > 0) {
+               credit[e.account] += e.change;
+            }
+         }
+      }
+   }
+
+   // link transactions through the unsafe accounts they touch
+   for (size_t i = 0; i < scope.size(); ++i) {
+      parent[i] = i;
+      if (state[scope[i]] != decision::undecided) {
+         continue;
+      }
+
+      for (const auto& e: log_entries[scope[i]]) {
+         if (left_out[e.account] || balances[e.account] >= credit[e.account]) {
+            continue;
+         }
+         if (owner[e.account] == npos) {
+            owner[e.account] = i;
+         } else {
+            parent[find(i)] = find(owner[e.account]);
+         }
+      }
+   }
+
+   // a group is needed if one of its unsafe accounts is negative
+   std::vector<size_t> part_of(scope.size(), npos);
+   for (size_t i = 0; i < scope.size(); ++i) {
+      if (state[scope[i]] != decision::undecided) {
+         continue;
+      }
+      for (const auto& e: log_entries[scope[i]]) {
+         if (negative_pos[e.account] != npos && part_of[find(i)] == npos) {
+            part_of[find(i)] = parts.size();
+            parts.emplace_back();
+         }
+      }
+   }
+
+   for (size_t i = 0; i < scope.size(); ++i) {
+      if (state[scope[i]] == decision::undecided && part_of[find(i)] != npos) {
+         parts[part_of[find(i)]].push_back(scope[i]);
+      }
+   }
+
+   // reset scratch space for the next call
+   for (const size_t log: scope) {
+      for (const auto& e: log_entries[log]) {
+         credit[e.account] = 0;
+         owner[e.account] = npos;
+      }
+   }
+}
+
+/**
+ * @return root of x in split()'s union-find. Uses path halving.
+ */
+size_t exact_settler::find(size_t x)
+{
+   while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+   }
+   return x;
+}
+
+/**
+ * Simulates a rollback of log.
+ */
+void exact_settler::drop(const size_t log)
+{
+   state[log] = decision::drop;
+   for (const auto& e: log_entries[log]) {
+      balances[e.account] -= e.change;
+      update_negative(e.account);
+   }
+}
+
+/**
+ * Undoes drop().
+ */
+void exact_settler::undrop(const size_t log)
+{
+   state[log] = decision::undecided;
+   for (const auto& e: log_entries[log]) {
+      balances[e.account] += e.change;
+      update_negative(e.account);
+   }
+}
+
+/**
+ * Adds or removes account from negatives to match its balance. Swap-and-pop keeps removal constant time.
+ */
+void exact_settler::update_negative(const size_t account)
+{
+   const bool is_negative = balances[account] < 0 && !left_out[account];
+   const bool listed = negative_pos[account] != npos;
+
+   if (is_negative && !listed) {
+      negative_pos[account] = negatives.size();
+      negatives.push_back(account);
+   } else if (!is_negative && listed) {
+      const size_t pos = negative_pos[account];
+      negative_pos[negatives.back()] = pos;
+      negatives[pos] = negatives.back();
+      negatives.pop_back();
+      negative_pos[account] = npos;
+   }
+}
+
+/**
+ * Takes account out of the accounts that have to end up >= 0, for good.
+ */
+void exact_settler::leave_out(const size_t account)
+{
+   left_out[account] = 1;
+   update_negative(account);
+}
+
+
+/**
+ * Builds the database from a vector.
+ * Uses std::transform to "transform" given vector to unordered_map.
+ */
+transaction_db::transaction_db(const vector<account_balance>& initial_balances): 
+               current_transaction(0), current_mode(settle_mode::greedy), forward_window(default_forward_window), greedy_policy(greedy_score::invalid_accounts), beam_width(default_beam_width), beam_depth(default_beam_depth), exact_node_limit(default_exact_node_limit), dense_ids(true), arena(std::make_unique<log_arena>()), first_pending(0), pending_count(0),
+               parallel_candidates(default_parallel_candidates), snapshot_every(1), settles_since_snapshot(0)
+{
+   accounts.reserve(initial_balances.size());
+   account_index.reserve(initial_balances.size());
+
+   // give every account the next dense index. If an account_id is repeated, the first one wins
+   for (const auto& accnt: initial_balances) {
+      if (account_index.emplace(accnt.account_id, accounts.size()).second) {
+         dense_ids = dense_ids && (accnt.account_id == static_cast<int>(accounts.size()));
+         accounts.push_back(accnt);
+      }
+   }
+
+   negative_pos.assign(accounts.size(), npos);
+   pending_by_account.resize(accounts.size());
+   for (size_t i = 0; i < accounts.size(); ++i) {
+      update_negative(i);
+   }
+}
+
+// out of line, write_ahead_log is incomplete in the header
+transaction_db::~transaction_db() = default;
+transaction_db::transaction_db(transaction_db&&) = default;
+transaction_db& transaction_db::operator=(transaction_db&&) = default;
+
+/**
+ * Appends the log to the pending transactions and records which accounts it touches.
+ */
+void transaction_db::add_pending(transaction_log* tlog)
+{
+   apply_transaction(*tlog);
+   for (const auto& accnt: *tlog) {
+      auto& pending = pending_by_account[accnt.account_id];
+      if (pending.empty()) {
+         pending_accounts.push_back(accnt.account_id);
+      }
+      pending.push_back(tlog->get_transaction_id());
+   }
+   if (temp_log.empty()) {
+      first_pending = tlog->get_transaction_id();
+   }
+   temp_log.push_back(tlog);
+   ++pending_count;
+   ++current_transaction; // increment the current_transaction
+}
+
+/**
+ * The new account is not negative and has no pending transactions, so only the bookkeeping vectors grow.
+ */
+size_t transaction_db::add_account(const int account_id)
+{
+   const size_t index = accounts.size();
+   dense_ids = dense_ids && (account_id == static_cast<int>(index));
+   account_index.emplace(account_id, index);
+   accounts.push_back({account_id, 0});
+   negative_pos.push_back(npos);
+   pending_by_account.emplace_back();
+   if (wal) {
+      wal->log_account(account_id);
+   }
+   if (snapshots || readers) {
+      dirty_pages.resize(index / state_view::page_size + 1, 1);
+      dirty_pages[index / state_view::page_size] = 1;
+   }
+   return index;
+}
+
+void transaction_db::log_push(const transaction& t, const size_t trans_id)
+{
+   wal->log_push(trans_id, t);
+}
+
+void transaction_db::end_push()
+{
+   wal->sync_point(wal_sync::push);
+}
+
+/**
+ * Changes from the most recent transaction applied to database.
+ */
+void transaction_db::apply_transaction(const transaction_log& tlog)
+{
+   // account_id is the dense index
+   for (const auto& accnt: tlog) {
+      accounts[accnt.account_id].balance += accnt.balance;
+      update_negative(accnt.account_id);
+   }
+}
+
+/**
+ * Only called for accounts that were just changed, so negative_accounts never needs a full scan.
+ * Swap-and-pop keeps removal constant time.
+ */
+void transaction_db::update_negative(const size_t account, std::vector<size_t>& negatives)
+{
+   const bool is_negative = accounts[account].balance < 0;
+   const bool listed = negative_pos[account] != npos;
+
+   if (is_negative && !listed) {
+      negative_pos[account] = negatives.size();
+      negatives.push_back(account);
+   } else if (!is_negative && listed) {
+      const size_t pos = negative_pos[account];
+      negative_pos[negatives.back()] = pos;
+      negatives[pos] = negatives.back();
+      negatives.pop_back();
+      negative_pos[account] = npos;
+   }
+}
+
+
+/**
+ * Dispatches to the selected strategy.
+ */
+void transaction_db::settle()
+{
+   run_settle([this](settle_stats& run) {
+      switch (current_mode) {
+      case settle_mode::branch_and_bound:
+         settle_branch_and_bound(run);
+         break;
+      case settle_mode::forward:
+         settle_forward(run);
+         break;
+      case settle_mode::beam:
+         settle_beam(run);
+         break;
+      case settle_mode::greedy:
+      default:
+         settle_greedy(run);
+         break;
+      }
+   });
+}
+
+void transaction_db::settle(const std::chrono::steady_clock::time_point deadline)
+{
+   run_settle([this, deadline](settle_stats& run) { settle_anytime(run, deadline); });
+}
+
+/**
+ * The strategy fills in its own rounds and candidates, everything else is known from the outside.
+ */
+void transaction_db::run_settle(const std::function<void(settle_stats&)>& strategy)
+{
+   if (ingest) {
+      throw std::logic_error("settle can't run before end_ingest.");
+   }
+
+   const auto start = std::chrono::steady_clock::now();
+
+   settle_stats run;
+   run.accounts_touched = pending_accounts.size();
+   const size_t pending = pending_count;
+   const size_t applied = applied_transactions.size();
+
+   strategy(run);
+
+   run.accepted = applied_transactions.size() - applied;
+   run.rollbacks = pending - run.accepted;
+   run.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+   stats.record_settle(run);
+}
+
+/**
+ * Saves the transaction_id's left in temp_log and clears it.
+ * The logs are never destroyed one by one. All of their memory came from arena, which is rewound in O(1).
+ */
+void transaction_db::commit()
+{
+   // recovery replays a settle by dropping the same transactions, so only those are logged
+   if (wal && !temp_log.empty()) {
+      std::vector<size_t> dropped;
+      for (size_t i = 0; i < temp_log.size(); ++i) {
+         if (!temp_log[i]) {
+            dropped.push_back(first_pending + i);
+         }
+      }
+      wal->log_settle(first_pending, temp_log.size(), dropped);
+   }
+
+   for (const transaction_log* x: temp_log) {
+      if (x) {
+         applied_transactions.insert(x->get_transaction_id());
+         if (snapshots || readers) {
+            unviewed_applied.push_back(x->get_transaction_id());
+         }
+      }
+   }
+
+   temp_log.clear();
+   pending_count = 0;
+   arena->reset();
+
+   // clear() keeps the capacity, so the next batch doesn't have to allocate again
+   for (const size_t account: pending_accounts) {
+      pending_by_account[account].clear();
+      if (snapshots || readers) {
+         dirty_pages[account / state_view::page_size] = 1;
+      }
+   }
+   pending_accounts.clear();
+
+   if (wal) {
+      wal->sync_point(wal_sync::settle);
+   }
+
+   // one view serves both when a snapshot is due. The last record has to be on disk before a snapshot can point at it
+   std::shared_ptr<const state_view> view;
+   if (snapshots && ++settles_since_snapshot >= snapshot_every) {
+      if (wal) {
+         wal->flush();
+      }
+      view = build_view(true);
+      settles_since_snapshot = 0;
+      snapshots->submit(view);
+   }
+   if (readers) {
+      view = view ? view : build_view(true);
+      readers->publish(read_view::settled, view);
+      readers->publish(read_view::current, std::move(view));
+   }
+}
+
+/**
+ * The log's memory stays in arena until the next commit().
+ */
+void transaction_db::drop_pending(const size_t trans_id)
+{
+   transaction_log*& tlog = temp_log[trans_id - first_pending];
+   rollback(*tlog);
+   tlog = nullptr;
+   --pending_count;
+}
+
+/**
+ * Same as drop_pending(), but safe to run next to other scopes.
+ */
+void transaction_db::drop_in_scope(settle_scope& scope, const size_t trans_id)
+{
+   transaction_log*& tlog = temp_log[trans_id - first_pending];
+   rollback(*tlog, scope.negatives);
+   tlog = nullptr;
+   ++scope.dropped;
+}
+
+/**
+ * @brief Puts database into a valid state by removing valid transactions.
+ *
+ * Algorithm Steps:
+ * 1) Check if there are any negative account balances. If not, then commit changes and exit.
+ * 2) Simulate rolling back every transaction in temp_log that touches a negative account and count the negative account balances each one leaves.
+ * 3) Keep the transaction with the fewest invalid account balances. Ties go to the oldest transaction.
+ * 4) Rollback and delete that transaction.
+ * 5) Goto step 1.
+ *
+ * The steps run separately in every settle_scope, see partition_pending(). A rollback only changes the count of its own
+ * scope, so each scope makes the same choices it would in one big loop over the whole database, and the scopes can run in parallel.
+ *
+ * Steps 2 and 3 don't rescan anything. Every transaction touching a negative account sits in an indexed_heap by its
+ * score, and a rollback only changes the balances of the accounts it touches. So only the transactions sharing an
+ * account with it can score differently, start touching a negative account or stop touching one, and they are found
+ * through pending_by_account. A round costs O(log n) per transaction sharing an account with the victim, instead of a
+ * pass over every transaction touching a negative account, and the check in step 1 is O(1).
+ * Loops instead of recursing so a bad batch with thousands of rollbacks can't overflow the stack.
+ *
+ * Main Assumption for Algorithm: Choosing results by fewest possible invalid accounts will lead to fewer transactions being rolled back.
+ *
+ * Thoughts:
+ *    Performance could probably be improved by storing information when a transaction is applied at an intermediate step.
+ *    However, the challenge here is finding an optimal solution without calculating every single combination.
+ *          For example, assume there are three transactions {A, B, C}. 
+ *             Calling get_invalid_accounts() changes for every unique intermediate state.
+ *             In other words, get_invalid_accounts(A) != get_invalid_accounts(A) if B is rolled back.
+ *             This is because get_invalid_accounts(transaction) returns the number of invalid accounts by
+ *                simulating a rollback of that transaction.
+ *
+ *    Because of this, I thought it would be good if a local optimal was chosen until a solution is found.
+ *    This approach does not guarantee that the global optimal solution is found.
+ *       Example: Assume this algorithm uses four transactions {A, B, C, D}.
+ *                Possible solution is to rollback in the following order {D, C, B}.
+ *                This solution means that in the first pass, D had the least simulated invalid accounts, C in the second pass, and then B.
+ *                However, the solution to rolling back the fewest transactions could be {A}, where A had the most invalid accounts in the first pass.
+ *                Since this algorithm does not check future possibilities, the shortest solution was not found.
+ *
+ *    Could most likely reimplement this algorithm as a dynamic algorithm and find the optimal solution.
+ *          To do this would mean changing my criteria from the number of invalid accounts to the number of transactions needed to rollback.
+ *          Instead of get_invalid_accounts(), I'd define has_invalid_accounts(), which would return as soon as a single invalid account is found, thereby improving time complexity.
+ *                Although, worst case would still be the same O(M) where M is the number of accounts in a transaction.
+ *          This basically transforms this problem into a shortest path problem.
+ *          Again, this biggest issue is that order of rollback matters and changes the state completely, so memoization might not be possible.
+ *
+ *    A brute force method would be possible to implement, but would scale very poorly as it would compute N! situtations where N is the number of transactions.
+ *       Maybe I could look a few steps into the future to choose the best solution?
+ *       (settle_mode::beam does, see settle_scope_beam().)
+ *
+ *    One approach I started to use looked at the specific accounts that were invalid; however, this fails because a transaction that fixes account 1 might make account 2 negative.
+ */
+void transaction_db::settle_greedy(settle_stats& run)
+{
+   if (get_invalid_accounts() == 0) {
+      commit();
+      return;
+   }
+
+   std::vector<settle_scope> scopes;
+   partition_pending(scopes);
+   heap_slot.assign(temp_log.size(), npos);
+   rescored_in.assign(temp_log.size(), 0);
+   for_each_scope(scopes, [this](settle_scope& scope, const bool parallel_scoring) { settle_scope_greedy(scope, parallel_scoring); });
+   merge_scopes(scopes, run);
+
+   commit();
+}
+
+/**
+ * Picks the policy once per scope, the rounds are compiled for each one so scoring a candidate never branches on it.
+ */
+void transaction_db::settle_scope_greedy(settle_scope& scope, const bool parallel_scoring)
+{
+   switch (greedy_policy) {
+   case greedy_score::deficit:
+      settle_scope_greedy<greedy_score::deficit>(scope, parallel_scoring);
+      break;
+   case greedy_score::repair_per_volume:
+      settle_scope_greedy<greedy_score::repair_per_volume>(scope, parallel_scoring);
+      break;
+   case greedy_score::fewest_transfers:
+      settle_scope_greedy<greedy_score::fewest_transfers>(scope, parallel_scoring);
+      break;
+   case greedy_score::invalid_accounts:
+   default:
+      settle_scope_greedy<greedy_score::invalid_accounts>(scope, parallel_scoring);
+      break;
+   }
+}
+
+/**
+ * Scores are kept with a fixed count of negative accounts instead of the scope's current one. The current count only
+ * shifts every candidate's rank by the same amount, so a score stays valid until one of the candidate's own accounts
+ * changes, and the heap's top is the same transaction a full pass would pick.
+ */
+template<greedy_score Policy>
+void transaction_db::settle_scope_greedy(settle_scope& scope, const bool parallel_scoring)
+{
+   // big enough for every shift without wrapping, see score_rollback()
+   const size_t invalid = accounts.size();
+   const auto slot = [this](const size_t id) { return id - first_pending; };
+
+   // every transaction touching a negative account, scored once. Big scopes are scored on the pool
+   std::vector<size_t> ids;
+   for (const size_t account: scope.negatives) {
+      for (const size_t id: pending_by_account[account]) {
+         if (temp_log[slot(id)]) {
+            ids.push_back(id);
+         }
+      }
+   }
+   std::sort(ids.begin(), ids.end());
+   ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+   std::vector<rollback_score> scores(ids.size());
+   if (parallel_scoring && pool && ids.size() >= parallel_candidates) {
+      score_candidates_parallel<Policy>(ids, scores, invalid);
+   } else {
+      for (size_t i = 0; i < ids.size(); ++i) {
+         scores[i] = score_rollback<Policy>(*temp_log[slot(ids[i])], invalid);
+      }
+   }
+   scope.candidates_scored += ids.size();
+
+   indexed_heap<rollback_score> heap(heap_slot);
+   std::vector<char> was_negative; // per entry of the round's victim
+   std::vector<char> flipped;
+   for (size_t i = 0; i < ids.size(); ++i) {
+      heap.push_unordered(slot(ids[i]), scores[i]);
+   }
+   heap.build();
+
+   // check if there are any invalid accounts in the scope's current, intermediate state
+   // 1)
+   while (!scope.negatives.empty()) {
+      ++scope.rounds;
+
+      // so we have invalid accounts, the transaction that results in the smallest number of invalid accounts
+      // (or whatever greedy_policy ranks best, see greedy_score) is the heap's top
+      // rollback_score ends in the id, so ties go to the oldest transaction
+      // 2) & 3)
+
+      // the negative accounts were negative before any pending transaction, nothing left can fix them
+      // they stay negative, see merge_scopes()
+      if (heap.empty()) {
+         return;
+      }
+
+      // now rollback the transaction that gives the smallest number of invalid balances and delete it
+      // 4)
+      const size_t victim = heap.top().id;
+      const transaction_log& rolled_back = *temp_log[slot(victim)];
+      was_negative.clear();
+      for (const auto& accnt: rolled_back) {
+         was_negative.push_back(negative_pos[accnt.account_id] != npos);
+      }
+      flipped.resize(was_negative.size());
+      heap.erase(slot(victim));
+      drop_in_scope(scope, victim);
+
+      // only the transactions sharing an account with it are rescored, dropped or added. Joining or leaving the
+      // candidates takes an account that just changed sign, so outside of those accounts' lists only the ones in the
+      // heap are looked at. When the victim touches a busy account that means walking a long list for a few of them,
+      // so once the walk is longer than the heap, the whole heap is rescored and rebuilt instead, like a full pass.
+      // rescored_in makes sure each is scored once per round
+      size_t walk = 0;
+      for (size_t i = 0; i < rolled_back.size(); ++i) {
+         const size_t account = rolled_back.begin()[i].account_id;
+         flipped[i] = was_negative[i] != (negative_pos[account] != npos);
+         walk += flipped[i] ? 0 : pending_by_account[account].size();
+      }
+      const bool rescore_all = walk > heap.size();
+      if (rescore_all) {
+         heap.rekey_all([&](const size_t pos, rollback_score& key) {
+            rescored_in[pos] = scope.rounds;
+            ++scope.candidates_scored;
+            key = score_rollback<Policy>(*temp_log[pos], invalid);
+            return true;
+         });
+      }
+
+      for (size_t i = 0; i < rolled_back.size(); ++i) {
+         if (rescore_all && !flipped[i]) {
+            continue;
+         }
+         for (const size_t id: pending_by_account[rolled_back.begin()[i].account_id]) {
+            const size_t pos = slot(id);
+            if (!temp_log[pos] || (!flipped[i] && !heap.contains(pos))) {
+               continue;
+            }
+
+            const transaction_log& tlog = *temp_log[pos];
+            if (flipped[i] && !touches_negative(tlog)) {
+               heap.erase(pos);
+            } else if (rescored_in[pos] != scope.rounds) {
+               rescored_in[pos] = scope.rounds;
+               ++scope.candidates_scored;
+               heap.set(pos, score_rollback<Policy>(tlog, invalid));
+            }
+         }
+      }
+
+      // now do it all again
+      // 5)
+   }
+}
+
+/**
+ * Equal chunks, a few per thread, each written to its own part of scores. Scoring only reads accounts.
+ */
+template<greedy_score Policy>
+void transaction_db::score_candidates_parallel(const std::vector<size_t>& ids, std::vector<rollback_score>& scores, const size_t invalid)
+{
+   const size_t tasks = std::min(ids.size(), pool->size() * 4);
+   pool->run(tasks, [this, tasks, invalid, &ids, &scores](const size_t task) {
+      const size_t first = ids.size() * task / tasks;
+      const size_t last = ids.size() * (task + 1) / tasks;
+      for (size_t i = first; i < last; ++i) {
+         scores[i] = score_rollback<Policy>(*temp_log[ids[i] - first_pending], invalid);
+      }
+   });
+}
+
+bool transaction_db::touches_negative(const transaction_log& tlog) const
+{
+   return std::any_of(tlog.begin(), tlog.end(), [this](const account_balance& accnt) { return negative_pos[accnt.account_id] != npos; });
+}
+
+/**
+ * The pool is only kept when there is more than one thread, settle checks for nullptr to pick the serial path.
+ */
+void transaction_db::set_beam(const size_t width, const size_t depth)
+{
+   if (width == 0 || depth == 0) {
+      throw std::invalid_argument("beam width and depth must be at least 1.");
+   }
+   beam_width = width;
+   beam_depth = depth;
+}
+
+void transaction_db::set_settle_threads(size_t threads, const size_t min_parallel_candidates)
+{
+   if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+   }
+
+   pool = threads > 1 ? std::make_unique<thread_pool>(threads) : nullptr;
+   parallel_candidates = min_parallel_candidates;
+}
+
+/**
+ * The state record is synced right away, whatever the policy, so a log that exists always has a starting point.
+ */
+void transaction_db::attach_wal(const char* path, const wal_sync sync, const size_t group_bytes)
+{
+   if (!temp_log.empty()) {
+      throw std::logic_error("attach_wal needs a settled database, pending transactions can't be logged.");
+   }
+
+   wal = nullptr; // a log already attached is finished first, in case it is the same file
+   auto log = std::make_unique<write_ahead_log>(path, 0, 0, 0, sync, group_bytes);
+   log->log_state(accounts, current_transaction, get_applied_transactions());
+   log->flush();
+   wal = std::move(log);
+}
+
+/**
+ * Replays the log through the same paths that wrote it. Stats only count what happens after recovery.
+ */
+transaction_db transaction_db::recover(const char* path, const wal_sync sync, const size_t group_bytes)
+{
+   wal_reader reader(path);
+   wal_record r;
+   if (!reader.next(r) || r.type != wal_record_type::state) {
+      throw std::runtime_error(std::string(path) + ": write-ahead log doesn't start with a state record.");
+   }
+
+   transaction_db db(r.accounts);
+   db.current_transaction = r.transaction_id;
+   db.applied_transactions.insert(r.ids.begin(), r.ids.end());
+   db.replay(reader, path);
+
+   db.reset_stats();
+   db.wal = std::make_unique<write_ahead_log>(path, reader.valid_bytes(), reader.last_offset(), reader.last_checksum(),
+                                              sync, group_bytes);
+   return db;
+}
+
+/**
+ * The snapshot names the last record it includes by offset and checksum. Replay starts right after that record,
+ * once it is confirmed to be the same one.
+ */
+transaction_db transaction_db::recover(const char* path, const char* snapshot_path, const wal_sync sync, const size_t group_bytes)
+{
+   if (::access(snapshot_path, F_OK) != 0) {
+      return recover(path, sync, group_bytes);
+   }
+
+   transaction_db db = load_snapshot(snapshot_path);
+   wal_reader reader(path);
+   wal_record r;
+   if (db.base_snapshot->wal_offset() == 0) {
+      throw std::runtime_error(std::string(snapshot_path) + " was taken without a write-ahead log.");
+   }
+   reader.seek(db.base_snapshot->wal_offset());
+   if (!reader.next(r) || reader.last_checksum() != db.base_snapshot->wal_checksum()) {
+      throw std::runtime_error(std::string(snapshot_path) + " doesn't match the write-ahead log " + path + ".");
+   }
+   db.replay(reader, path);
+
+   db.reset_stats();
+   db.wal = std::make_unique<write_ahead_log>(path, reader.valid_bytes(), reader.last_offset(), reader.last_checksum(),
+                                              sync, group_bytes);
+   return db;
+}
+
+/**
+ * Pushes go back through push_transactions with accounts_must_exist, since every account a validation policy created
+ * has its own record ahead of the push. A settle is replayed by dropping the transactions it dropped, then committing.
+ */
+void transaction_db::replay(wal_reader& reader, const char* path)
+{
+   auto corrupt = [path](const char* what) {
+      return std::runtime_error(std::string(path) + ": " + what);
+   };
+
+   wal_record r;
+   while (reader.next(r)) {
+      switch (r.type) {
+      case wal_record_type::account:
+         if (account_index.count(r.account_id) != 0) {
+            throw corrupt("write-ahead log creates an account that already exists.");
+         }
+         add_account(r.account_id);
+         break;
+      case wal_record_type::push:
+         if (r.transaction_id != current_transaction ||
+             push_transactions(array_view<const transaction>(&r.transfers, 1)).front() != push_status::accepted) {
+            throw corrupt("write-ahead log push doesn't replay.");
+         }
+         break;
+      case wal_record_type::settle:
+         if (r.transaction_id != first_pending || r.transaction_count != temp_log.size()) {
+            throw corrupt("write-ahead log settle doesn't match the pending transactions.");
+         }
+         for (const size_t id: r.ids) {
+            if (id - first_pending >= temp_log.size() || !temp_log[id - first_pending]) {
+               throw corrupt("write-ahead log settle drops a transaction that isn't pending.");
+            }
+            drop_pending(id);
+         }
+         commit();
+         break;
+      default:
+         throw corrupt("write-ahead log has a second state record.");
+      }
+   }
+}
+
+/**
+ * Only the accounts are copied. The constructor indexes them, so dense ids survive the round trip.
+ */
+transaction_db transaction_db::load_snapshot(const char* path)
+{
+   auto snapshot = std::make_shared<const snapshot_reader>(path);
+   transaction_db db(std::vector<account_balance>(snapshot->accounts().begin(), snapshot->accounts().end()));
+   db.current_transaction = snapshot->next_transaction();
+   db.base_snapshot = std::move(snapshot);
+   return db;
+}
+
+void transaction_db::enable_snapshots(const char* path, const size_t every_settles)
+{
+   snapshots = nullptr; // a snapshot already queued is finished first, in case it is the same file
+   start_views();
+   snapshot_every = std::max<size_t>(every_settles, 1);
+   settles_since_snapshot = 0;
+   snapshots = std::make_unique<checkpointer>(path);
+}
+
+void transaction_db::wait_for_snapshot()
+{
+   if (snapshots) {
+      snapshots->wait();
+   }
+}
+
+/**
+ * Publishes the state right away, so readers never find nothing.
+ */
+void transaction_db::enable_read_snapshots(const size_t max_readers)
+{
+   if (readers) {
+      throw std::logic_error("enable_read_snapshots can only be called once.");
+   }
+   start_views();
+   readers = std::make_unique<published_views>(max_readers);
+
+   std::shared_ptr<const state_view> view = build_view(temp_log.empty());
+   if (view->settled) {
+      readers->publish(read_view::settled, view);
+   }
+   readers->publish(read_view::current, std::move(view));
+}
+
+void transaction_db::publish_balances()
+{
+   if (!readers) {
+      throw std::logic_error("publish_balances needs enable_read_snapshots first.");
+   }
+   readers->publish(read_view::current, build_view(temp_log.empty()));
+}
+
+/**
+ * Pin first, then load: see epoch_domain for why that order keeps the loaded view alive.
+ * Before the first settle, a database with pending transactions has no settled version, so the current one stands in.
+ */
+read_snapshot transaction_db::read_balances(const read_view which) const
+{
+   if (!readers) {
+      throw std::logic_error("read_balances needs enable_read_snapshots first.");
+   }
+
+   const size_t slot = readers->epochs.pin();
+   const state_view* view = readers->latest[static_cast<size_t>(which)].load();
+   if (!view) {
+      view = readers->latest[static_cast<size_t>(read_view::current)].load();
+   }
+   return read_snapshot(&readers->epochs, slot, view);
+}
+
+/**
+ * A few shards per producer, so threads rarely hash onto the same one.
+ */
+void transaction_db::begin_ingest(size_t producers)
+{
+   if (ingest) {
+      throw std::logic_error("begin_ingest was already called.");
+   }
+   if (wal) {
+      throw std::logic_error("begin_ingest can't be used with a write-ahead log.");
+   }
+
+   producers = producers ? producers : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+   ingest = std::make_unique<ingest_state>(current_transaction, accounts.size(), producers * 4);
+}
+
+/**
+ * The log is built under the shard lock, since the shard's arena isn't thread safe, and applied one account at a time
+ * under that account's stripe lock. A log touches each account once, so a producer never holds two locks.
+ */
+void transaction_db::ingest_validated(const transaction& validated_transfers)
+{
+   auto accept = [](transfer&) { return true; };
+
+   ingest_shard& shard = ingest->shard_for_this_thread();
+   transaction_log* tlog = nullptr;
+   {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      void* memory = shard.arena.allocate(sizeof(transaction_log), alignof(transaction_log));
+      tlog = new (memory) transaction_log(validated_transfers, ingest->next_id.fetch_add(1), accept, &shard.arena);
+      shard.logs.push_back(tlog);
+   }
+
+   for (const auto& accnt: *tlog) {
+      const size_t account = accnt.account_id;
+      account_stripe& stripe = ingest->stripe_of(account);
+      std::lock_guard<std::mutex> guard(stripe.lock);
+      accounts[account].balance += accnt.balance;
+      pending_by_account[account].push_back(tlog->get_transaction_id());
+      if (!ingest->seen[account]) {
+         ingest->seen[account] = 1;
+         stripe.touched.push_back(account);
+      }
+   }
+   ingest->transfers.fetch_add(validated_transfers.size());
+}
+
+void transaction_db::ingest_rejected()
+{
+   ingest->rejected.fetch_add(1);
+}
+
+/**
+ * Puts back what ingest_transaction() left out of order: logs go to their place in temp_log by id, and each touched
+ * account's pending list is sorted. Ids from before the ingest are all smaller, so they stay in front.
+ * Only touched accounts changed balance, so they are the only ones whose negative_accounts entry can be stale.
+ */
+void transaction_db::end_ingest()
+{
+   if (!ingest) {
+      throw std::logic_error("end_ingest needs begin_ingest first.");
+   }
+
+   const size_t end_id = ingest->next_id.load();
+   if (temp_log.empty()) {
+      first_pending = current_transaction;
+   }
+   temp_log.resize(end_id - first_pending, nullptr);
+   for (size_t i = 0; i < ingest->shard_count; ++i) {
+      ingest_shard& shard = ingest->shards[i];
+      for (transaction_log* tlog: shard.logs) {
+         temp_log[tlog->get_transaction_id() - first_pending] = tlog;
+      }
+      arena->adopt(shard.arena);
+   }
+
+   for (size_t i = 0; i < ingest_state::stripe_count; ++i) {
+      for (const size_t account: ingest->stripes[i].touched) {
+         auto& pending = pending_by_account[account];
+         std::sort(pending.begin(), pending.end());
+         if (pending.front() >= ingest->first_id) {
+            pending_accounts.push_back(account);
+         }
+         update_negative(account);
+      }
+   }
+
+   pending_count += end_id - current_transaction;
+   stats.accepted_transactions += end_id - current_transaction;
+   stats.rejected_transactions += ingest->rejected.load();
+   stats.validated_transfers += ingest->transfers.load();
+   current_transaction = end_id;
+   ingest = nullptr;
+}
+
+/**
+ * Everything is dirty to begin with. Applied ids already in applied_transactions go into the first view's segment.
+ */
+void transaction_db::start_views()
+{
+   latest_view = nullptr;
+   dirty_pages.assign((accounts.size() + state_view::page_size - 1) / state_view::page_size, 1);
+   unviewed_applied.assign(applied_transactions.begin(), applied_transactions.end());
+}
+
+/**
+ * Pending transactions only mark their pages at commit, so between settles every account they touched counts as dirty.
+ */
+std::shared_ptr<const state_view> transaction_db::build_view(const bool settled)
+{
+   for (const size_t account: pending_accounts) {
+      dirty_pages[account / state_view::page_size] = 1;
+   }
+
+   auto view = std::make_shared<state_view>();
+   view->settled = settled;
+   view->next_transaction = current_transaction;
+   view->wal_offset = wal ? wal->last_record_offset() : 0;
+   view->wal_checksum = wal ? wal->last_record_checksum() : 0;
+   view->account_count = accounts.size();
+   view->base = base_snapshot;
+
+   const size_t page_count = dirty_pages.size();
+   if (latest_view) {
+      view->pages = latest_view->pages;
+      view->applied = latest_view->applied;
+   }
+   view->pages.resize(page_count);
+   for (size_t p = 0; p < page_count; ++p) {
+      if (dirty_pages[p]) {
+         const auto first = accounts.begin() + p * state_view::page_size;
+         const auto last = accounts.begin() + std::min(accounts.size(), (p + 1) * state_view::page_size);
+         view->pages[p] = std::make_shared<const state_view::page>(first, last);
+         dirty_pages[p] = 0;
+      }
+   }
+   if (!unviewed_applied.empty()) {
+      view->applied.push_back(std::make_shared<const state_view::segment>(std::move(unviewed_applied)));
+      unviewed_applied.clear();
+   }
+
+   latest_view = view;
+   return view;
+}
+
+/**
+ * Union-find over positions in temp_log: every account joins the transactions in its pending list.
+ * Only the roots holding a negative account become scopes, the rest of the batch is never looked at again.
+ * Every negative account's position in negative_pos is moved to its scope's negatives.
+ */
+void transaction_db::partition_pending(std::vector<settle_scope>& scopes)
+{
+   scope_parent.resize(temp_log.size());
+   std::iota(scope_parent.begin(), scope_parent.end(), 0);
+
+   // path halving keeps the trees flat without recursion
+   const auto find = [this](size_t x) {
+      while (scope_parent[x] != x) {
+         scope_parent[x] = scope_parent[scope_parent[x]];
+         x = scope_parent[x];
+      }
+      return x;
+   };
+
+   for (const size_t account: pending_accounts) {
+      const auto& pending = pending_by_account[account];
+      const size_t first = find(pending.front() - first_pending);
+      for (size_t i = 1; i < pending.size(); ++i) {
+         const size_t root = find(pending[i] - first_pending);
+         if (root != first) {
+            scope_parent[root] = first;
+         }
+      }
+   }
+
+   scope_of.assign(temp_log.size(), npos);
+   std::vector<size_t> unfixable;
+   for (const size_t account: negative_accounts) {
+      const auto& pending = pending_by_account[account];
+      if (pending.empty()) {
+         unfixable.push_back(account);
+         continue;
+      }
+
+      size_t& scope = scope_of[find(pending.front() - first_pending)];
+      if (scope == npos) {
+         scope = scopes.size();
+         scopes.emplace_back();
+      }
+      negative_pos[account] = scopes[scope].negatives.size();
+      scopes[scope].negatives.push_back(account);
+   }
+
+   // ascending because temp_log is in id order
+   for (size_t i = 0; i < temp_log.size(); ++i) {
+      const size_t scope = temp_log[i] ? scope_of[find(i)] : npos;
+      if (scope != npos) {
+         scopes[scope].logs.push_back(first_pending + i);
+      }
+   }
+
+   negative_accounts.swap(unfixable);
+   for (size_t i = 0; i < negative_accounts.size(); ++i) {
+      negative_pos[negative_accounts[i]] = i;
+   }
+}
+
+/**
+ * Biggest first, so a large scope doesn't end up alone on one thread after everything else has finished.
+ */
+void transaction_db::for_each_scope(std::vector<settle_scope>& scopes, const std::function<void(settle_scope&, bool)>& settle_one)
+{
+   if (!pool) {
+      for (auto& scope: scopes) {
+         settle_one(scope, false);
+      }
+      return;
+   }
+
+   std::vector<settle_scope*> order;
+   for (auto& scope: scopes) {
+      order.push_back(&scope);
+   }
+   std::sort(order.begin(), order.end(), [](const settle_scope* a, const settle_scope* b) { return a->logs.size() > b->logs.size(); });
+
+   size_t big = 0;
+   while (big < order.size() && order[big]->logs.size() >= parallel_candidates) {
+      settle_one(*order[big++], true);
+   }
+   pool->run(order.size() - big, [&order, &settle_one, big](const size_t i) { settle_one(*order[big + i], false); });
+}
+
+/**
+ * A scope left with negative accounts has one no pending transaction can fix. Dropping the rest of the scope wouldn't
+ * change that, so every scope keeps what it settled on, and the accounts that couldn't be fixed stay negative, like the
+ * ones no pending transaction touches.
+ */
+void transaction_db::merge_scopes(std::vector<settle_scope>& scopes, settle_stats& run)
+{
+   for (auto& scope: scopes) {
+      pending_count -= scope.dropped;
+      run.rounds += scope.rounds;
+      run.candidates_scored += scope.candidates_scored;
+      run.exact_fallbacks += scope.exact_fallbacks;
+
+      for (const size_t account: scope.negatives) {
+         negative_pos[account] = negative_accounts.size();
+         negative_accounts.push_back(account);
+      }
+   }
+}
+
+/**
+ * Hands every scope's transactions to its own exact_settler, then rolls back the ones it chose to drop.
+ * Returns early without searching if the database is already valid.
+ */
+void transaction_db::settle_branch_and_bound(settle_stats& run)
+{
+   if (get_invalid_accounts() == 0) {
+      commit();
+      return;
+   }
+
+   std::vector<settle_scope> scopes;
+   partition_pending(scopes);
+   heap_slot.assign(temp_log.size(), npos);
+   rescored_in.assign(temp_log.size(), 0);
+   for_each_scope(scopes, [this](settle_scope& scope, const bool parallel_scoring) { settle_scope_exact(scope, parallel_scoring); });
+   merge_scopes(scopes, run);
+
+   commit();
+}
+
+/**
+ * exact_settler only reads balances of the scope's own accounts, so scopes can search side by side.
+ * A search that runs out of nodes has changed nothing, so the greedy settle starts from the same state.
+ */
+void transaction_db::settle_scope_exact(settle_scope& scope, const bool parallel_scoring)
+{
+   std::vector<const transaction_log*> logs;
+   logs.reserve(scope.logs.size());
+   for (const size_t id: scope.logs) {
+      logs.push_back(temp_log[id - first_pending]);
+   }
+
+   exact_settler search(logs, [this](int account_id) { return accounts[account_id].balance; }, exact_node_limit);
+   const auto dropped = search.solve();
+   scope.rounds = search.nodes_searched();
+   scope.candidates_scored = logs.size();
+
+   if (search.ran_out_of_nodes()) {
+      ++scope.exact_fallbacks;
+      settle_scope_greedy(scope, parallel_scoring);
+      return;
+   }
+
+   for (size_t i = 0; i < logs.size(); ++i) {
+      if (dropped[i]) {
+         drop_in_scope(scope, scope.logs[i]);
+      }
+   }
+}
+
+/**
+ * Scopes without a negative account are valid as they are and keep every transaction, like with the other strategies.
+ */
+void transaction_db::settle_forward(settle_stats& run)
+{
+   if (get_invalid_accounts() == 0) {
+      commit();
+      return;
+   }
+
+   std::vector<settle_scope> scopes;
+   partition_pending(scopes);
+   forward_wanted.resize(accounts.size(), 0);
+   for_each_scope(scopes, [this](settle_scope& scope, bool) { settle_scope_forward(scope); });
+   merge_scopes(scopes, run);
+
+   commit();
+}
+
+/**
+ * Taking the scope's transactions back out leaves its accounts at their settled balances, and nothing outside the scope
+ * touches them. From there every transaction is applied in id order if it fits. One that doesn't waits in deferred,
+ * oldest first, until forward_window later transactions have gone by, then it is dropped.
+ *
+ * Waiting transactions are only tried again when an accepted one pays into an account some of them take money from,
+ * which forward_wanted counts. So a transaction costs its own entries plus at most a sweep over the window, and the
+ * whole pass is linear in the scope's log entries for a fixed window. Ties go to the oldest transaction: it is tried
+ * first in every sweep.
+ *
+ * rounds counts the sweeps, candidates_scored every fits() check.
+ */
+void transaction_db::settle_scope_forward(settle_scope& scope)
+{
+   drop_replayed(scope, replay_forward(scope));
+}
+
+std::vector<size_t> transaction_db::replay_forward(settle_scope& scope)
+{
+   for (const size_t id: scope.logs) {
+      for (const auto& accnt: *temp_log[id - first_pending]) {
+         accounts[accnt.account_id].balance -= accnt.balance;
+      }
+   }
+
+   const auto log_at = [this, &scope](const size_t pos) -> const transaction_log& { return *temp_log[scope.logs[pos] - first_pending]; };
+   const auto apply = [this](const transaction_log& tlog) {
+      bool pays_wanted = false;
+      for (const auto& accnt: tlog) {
+         accounts[accnt.account_id].balance += accnt.balance;
+         pays_wanted = pays_wanted || (accnt.balance > 0 && forward_wanted[accnt.account_id] > 0);
+      }
+      return pays_wanted;
+   };
+   const auto want = [this](const transaction_log& tlog, const bool waiting) {
+      for (const auto& accnt: tlog) {
+         if (accnt.balance < 0) {
+            forward_wanted[accnt.account_id] += waiting ? 1 : -1;
+         }
+      }
+   };
+
+   std::vector<size_t> deferred; // positions in scope.logs, ascending
+   std::vector<size_t> rejected;
+   const auto sweep = [&]() {
+      ++scope.rounds;
+      size_t kept = 0;
+      for (const size_t pos: deferred) {
+         ++scope.candidates_scored;
+         if (fits(log_at(pos))) {
+            want(log_at(pos), false);
+            apply(log_at(pos));
+         } else {
+            deferred[kept++] = pos;
+         }
+      }
+      deferred.resize(kept);
+   };
+
+   ++scope.rounds;
+   for (size_t pos = 0; pos < scope.logs.size(); ++pos) {
+      size_t expired = 0;
+      while (expired < deferred.size() && deferred[expired] + forward_window < pos) {
+         want(log_at(deferred[expired]), false);
+         rejected.push_back(deferred[expired++]);
+      }
+      deferred.erase(deferred.begin(), deferred.begin() + expired);
+
+      ++scope.candidates_scored;
+      const transaction_log& tlog = log_at(pos);
+      if (!fits(tlog)) {
+         if (forward_window == 0) {
+            rejected.push_back(pos);
+         } else {
+            want(tlog, true);
+            deferred.push_back(pos);
+         }
+      } else if (apply(tlog)) {
+         sweep();
+      }
+   }
+
+   // one last chance for whatever is still waiting
+   if (!deferred.empty()) {
+      sweep();
+   }
+   for (const size_t pos: deferred) {
+      want(log_at(pos), false);
+      rejected.push_back(pos);
+   }
+
+   // expired ones went in ascending, so did the ones left at the end, but a window of 0 mixes them
+   std::sort(rejected.begin(), rejected.end());
+   return rejected;
+}
+
+/**
+ * Balances only changed on the scope's accounts, negatives are brought up to date before the logs go away.
+ */
+void transaction_db::drop_replayed(settle_scope& scope, const std::vector<size_t>& positions)
+{
+   for (const size_t id: scope.logs) {
+      for (const auto& accnt: *temp_log[id - first_pending]) {
+         update_negative(accnt.account_id, scope.negatives);
+      }
+   }
+   for (const size_t pos: positions) {
+      temp_log[scope.logs[pos] - first_pending] = nullptr;
+      ++scope.dropped;
+   }
+}
+
+/**
+ * Same outline as settle_greedy(), only the choice of the rollback differs.
+ */
+void transaction_db::settle_beam(settle_stats& run)
+{
+   if (get_invalid_accounts() == 0) {
+      commit();
+      return;
+   }
+
+   std::vector<settle_scope> scopes;
+   partition_pending(scopes);
+   for_each_scope(scopes, [this](settle_scope& scope, bool) { settle_scope_beam(scope); });
+   merge_scopes(scopes, run);
+
+   commit();
+}
+
+/**
+ * Every round searches from the scope's current state, one level per rollback, up to beam_depth levels:
+ *    1) Every state of the level is entered by rolling back its path, and each transaction still applied that touches one
+ *       of its negative accounts becomes a child, scored like a simulated rollback in settle_scope_greedy().
+ *    2) The children are ordered by deficit left, then negative accounts left, and the first beam_width of them that
+ *       aren't the same set of rollbacks as one already taken become the next level.
+ *    3) If a child leaves no negative account, no shallower state did, so its whole path is rolled back and the scope is done.
+ * Otherwise the first step towards the best state of the last level is rolled back and the next round starts over from
+ * there. The search only keeps beam_width states per level and each state is a node pointing at its parent, so a round
+ * holds beam_width * beam_depth nodes, whatever the size of the scope. Ties go to the parent found first, then the oldest
+ * transaction, so the result doesn't depend on the thread count.
+ *
+ * rounds counts the searches, candidates_scored every child.
+ */
+void transaction_db::settle_scope_beam(settle_scope& scope)
+{
+   struct child {
+      long long deficit;
+      size_t invalid;
+      size_t parent;
+      size_t id;
+      std::uint64_t path_hash;
+   };
+
+   // splitmix64, a sum of mixed ids doesn't care about the order they were rolled back in
+   const auto mix = [](std::uint64_t x) {
+      x += 0x9e3779b97f4a7c15ull;
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+      return x ^ (x >> 31);
+   };
+
+   std::vector<beam_node> nodes;
+   std::vector<size_t> level;
+   std::vector<size_t> next;
+   std::vector<size_t> path;
+   std::vector<size_t> candidates;
+   std::vector<child> children;
+   std::vector<size_t> ids_a;
+   std::vector<size_t> ids_b;
+
+   const auto same_state = [&](const size_t node, const child& c) {
+      if (nodes[node].path_hash != c.path_hash) {
+         return false;
+      }
+      ids_a.clear();
+      for (size_t n = node; nodes[n].parent != npos; n = nodes[n].parent) {
+         ids_a.push_back(nodes[n].id);
+      }
+      ids_b.assign(1, c.id);
+      for (size_t n = c.parent; nodes[n].parent != npos; n = nodes[n].parent) {
+         ids_b.push_back(nodes[n].id);
+      }
+      std::sort(ids_a.begin(), ids_a.end());
+      std::sort(ids_b.begin(), ids_b.end());
+      return ids_a == ids_b;
+   };
+
+   while (!scope.negatives.empty()) {
+      long long deficit = 0;
+      for (const size_t account: scope.negatives) {
+         deficit -= accounts[account].balance;
+      }
+      nodes.clear();
+      nodes.push_back({npos, npos, deficit, scope.negatives.size(), 0});
+      level.assign(1, 0);
+
+      for (size_t step = 0; step < beam_depth && nodes[level.front()].invalid > 0; ++step) {
+         // 1)
+         children.clear();
+         for (const size_t node: level) {
+            enter_beam_path(nodes, node, path, scope);
+
+            // a transaction touching several negative accounts is only taken from the list of the first one in its log
+            candidates.clear();
+            for (const size_t account: scope.negatives) {
+               for (const size_t id: pending_by_account[account]) {
+                  const transaction_log* tlog = temp_log[id - first_pending];
+                  if (!tlog || std::find(path.begin(), path.end(), id) != path.end()) {
+                     continue;
+                  }
+                  const auto owner = std::find_if(tlog->begin(), tlog->end(), [this](const auto& accnt) {
+                     return negative_pos[accnt.account_id] != npos;
+                  });
+                  if (static_cast<size_t>(owner->account_id) == account) {
+                     candidates.push_back(id);
+                  }
+               }
+            }
+
+            for (const size_t id: candidates) {
+               ++scope.candidates_scored;
+               const rollback_effect effect = simulate_rollback(*temp_log[id - first_pending], scope.negatives.size());
+               children.push_back({nodes[node].deficit - effect.repaired, effect.invalid, node, id, nodes[node].path_hash + mix(id)});
+            }
+
+            restore_beam_path(path, scope);
+         }
+
+         // the negative accounts left in every state were negative before any pending transaction
+         if (children.empty()) {
+            break;
+         }
+
+         // 2) only the best beam_width are sorted, the rest only if states reached twice leave the level short
+         const auto better = [](const child& a, const child& b) {
+            if (a.deficit != b.deficit) {
+               return a.deficit < b.deficit;
+            }
+            if (a.invalid != b.invalid) {
+               return a.invalid < b.invalid;
+            }
+            return a.parent != b.parent ? a.parent < b.parent : a.id < b.id;
+         };
+         const size_t sorted = std::min(beam_width, children.size());
+         std::partial_sort(children.begin(), children.begin() + sorted, children.end(), better);
+         next.clear();
+         for (size_t i = 0; i < children.size() && next.size() < beam_width; ++i) {
+            if (i == sorted) {
+               std::sort(children.begin() + sorted, children.end(), better);
+            }
+            const child& c = children[i];
+            if (std::none_of(next.begin(), next.end(), [&](const size_t node) { return same_state(node, c); })) {
+               nodes.push_back({c.parent, c.id, c.deficit, c.invalid, c.path_hash});
+               next.push_back(nodes.size() - 1);
+            }
+         }
+         level.swap(next);
+      }
+
+      // nothing left can fix the scope, it keeps what it has, see merge_scopes()
+      if (level.front() == 0) {
+         return;
+      }
+
+      // 3)
+      size_t first = level.front();
+      if (nodes[first].invalid == 0) {
+         for (; first != 0; first = nodes[first].parent) {
+            drop_in_scope(scope, nodes[first].id);
+         }
+         ++scope.rounds;
+         continue;
+      }
+      while (nodes[first].parent != 0) {
+         first = nodes[first].parent;
+      }
+      drop_in_scope(scope, nodes[first].id);
+      ++scope.rounds;
+   }
+}
+
+void transaction_db::enter_beam_path(const std::vector<beam_node>& nodes, size_t node, std::vector<size_t>& path, settle_scope& scope)
+{
+   path.clear();
+   for (; nodes[node].parent != npos; node = nodes[node].parent) {
+      path.push_back(nodes[node].id);
+      rollback(*temp_log[nodes[node].id - first_pending], scope.negatives);
+   }
+}
+
+void transaction_db::restore_beam_path(const std::vector<size_t>& path, settle_scope& scope)
+{
+   for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      for (const auto& accnt: *temp_log[*it - first_pending]) {
+         accounts[accnt.account_id].balance += accnt.balance;
+         update_negative(accnt.account_id, scope.negatives);
+      }
+   }
+}
+
+/**
+ * Same outline as settle_forward(). Scopes search side by side on the pool, each against the same deadline.
+ */
+void transaction_db::settle_anytime(settle_stats& run, const std::chrono::steady_clock::time_point deadline)
+{
+   if (get_invalid_accounts() == 0) {
+      commit();
+      return;
+   }
+
+   std::vector<settle_scope> scopes;
+   partition_pending(scopes);
+   forward_wanted.resize(accounts.size(), 0);
+   for_each_scope(scopes, [this, deadline](settle_scope& scope, bool) { settle_scope_anytime(scope, deadline); });
+   merge_scopes(scopes, run);
+
+   commit();
+}
+
+/**
+ * A scope still negative after the forward pass has an account no pending transaction can fix. improve_scope() needs
+ * every balance valid, so such a scope keeps what the forward pass kept.
+ */
+void transaction_db::settle_scope_anytime(settle_scope& scope, const std::chrono::steady_clock::time_point deadline)
+{
+   std::vector<size_t> dropped = replay_forward(scope);
+   bool valid = true;
+   for (const size_t id: scope.logs) {
+      for (const auto& accnt: *temp_log[id - first_pending]) {
+         valid = valid && accounts[accnt.account_id].balance >= 0;
+      }
+   }
+   if (valid) {
+      improve_scope(scope, dropped, deadline);
+   }
+   drop_replayed(scope, dropped);
+}
+
+/**
+ * Every balance of the scope stays valid between moves, and every move that is kept applies one transaction more, so
+ * the state is always the best one found and the search ends by itself after at most one move per dropped transaction.
+ * A round is:
+ *    1) Put back every dropped transaction that fits, oldest first.
+ *    2) For each dropped transaction, try every kept one that takes money from an account it would overdraw: roll the
+ *       kept one back, apply the dropped one if it fits and the accounts the kept one paid into stay valid, then put back
+ *       the dropped transactions that take money from where the swap freed some. At least one must fit, else the swap is
+ *       undone. The first swap that sticks starts the next round.
+ *
+ * The clock is read before every swap, a round that started is only ever cut short between swaps.
+ * rounds counts the rounds, candidates_scored every put back and swap tried, on top of the forward pass.
+ */
+void transaction_db::improve_scope(settle_scope& scope, std::vector<size_t>& dropped, const std::chrono::steady_clock::time_point deadline)
+{
+   std::vector<char> kept(scope.logs.size(), 1);
+   for (const size_t pos: dropped) {
+      kept[pos] = 0;
+   }
+
+   const auto log_at = [this, &scope](const size_t pos) -> const transaction_log& { return *temp_log[scope.logs[pos] - first_pending]; };
+   const auto position_of = [&scope](const size_t id) {
+      return static_cast<size_t>(std::lower_bound(scope.logs.begin(), scope.logs.end(), id) - scope.logs.begin());
+   };
+   const auto apply = [this, &kept, &log_at](const size_t pos) {
+      for (const auto& accnt: log_at(pos)) {
+         accounts[accnt.account_id].balance += accnt.balance;
+      }
+      kept[pos] = 1;
+   };
+   const auto remove = [this, &kept, &log_at](const size_t pos) {
+      for (const auto& accnt: log_at(pos)) {
+         accounts[accnt.account_id].balance -= accnt.balance;
+      }
+      kept[pos] = 0;
+   };
+   const auto takes_from = [](const transaction_log& tlog, const size_t account) {
+      for (const auto& accnt: tlog) {
+         if (static_cast<size_t>(accnt.account_id) == account) {
+            return accnt.balance < 0;
+         }
+      }
+      return false;
+   };
+
+   std::vector<size_t> freed;  // accounts a swap left more money in
+   std::vector<size_t> gained; // positions put back after a swap
+   bool improved = true;
+   while (improved && std::chrono::steady_clock::now() < deadline) {
+      improved = false;
+      ++scope.rounds;
+
+      // 1)
+      size_t left = 0;
+      for (const size_t pos: dropped) {
+         ++scope.candidates_scored;
+         if (fits(log_at(pos))) {
+            apply(pos);
+         } else {
+            dropped[left++] = pos;
+         }
+      }
+      dropped.resize(left);
+
+      // 2)
+      for (size_t i = 0; i < dropped.size() && !improved; ++i) {
+         const size_t in = dropped[i];
+         for (const auto& need: log_at(in)) {
+            if (improved || need.balance >= 0 || static_cast<long long>(accounts[need.account_id].balance) + need.balance >= 0) {
+               continue;
+            }
+            for (const size_t id: pending_by_account[need.account_id]) {
+               const size_t out = position_of(id);
+               if (!kept[out] || !takes_from(log_at(out), need.account_id)) {
+                  continue;
+               }
+               if (std::chrono::steady_clock::now() >= deadline) {
+                  return;
+               }
+               ++scope.candidates_scored;
+
+               remove(out);
+               bool valid = fits(log_at(in));
+               if (valid) {
+                  apply(in);
+                  for (const auto& accnt: log_at(out)) {
+                     valid = valid && accounts[accnt.account_id].balance >= 0;
+                  }
+                  if (!valid) {
+                     remove(in);
+                  }
+               }
+               if (!valid) {
+                  apply(out);
+                  continue;
+               }
+
+               freed.clear();
+               for (const auto& accnt: log_at(out)) {
+                  if (accnt.balance < 0) {
+                     freed.push_back(accnt.account_id);
+                  }
+               }
+               for (const auto& accnt: log_at(in)) {
+                  if (accnt.balance > 0) {
+                     freed.push_back(accnt.account_id);
+                  }
+               }
+               gained.clear();
+               for (const size_t account: freed) {
+                  for (const size_t other: pending_by_account[account]) {
+                     const size_t pos = position_of(other);
+                     if (!kept[pos] && pos != out && fits(log_at(pos))) {
+                        apply(pos);
+                        gained.push_back(pos);
+                     }
+                  }
+               }
+
+               if (gained.empty()) {
+                  remove(in);
+                  apply(out);
+                  continue;
+               }
+
+               // kept marks who is in now, dropped is rebuilt from it
+               dropped.push_back(out);
+               left = 0;
+               for (const size_t pos: dropped) {
+                  if (!kept[pos]) {
+                     dropped[left++] = pos;
+                  }
+               }
+               dropped.resize(left);
+               std::sort(dropped.begin(), dropped.end());
+               improved = true;
+               break;
+            }
+         }
+      }
+   }
+}
+
+/**
+ * Entries paying into an account always fit, even when it is negative, so a scope that starts from a negative
+ * settled balance can still be paid back.
+ */
+bool transaction_db::fits(const transaction_log& tlog) const
+{
+   for (const auto& accnt: tlog) {
+      if (accnt.balance < 0 && static_cast<long long>(accounts[accnt.account_id].balance) + accnt.balance < 0) {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * accounts is already a vector<account_balance> holding the external account_id's, so this is a straight copy.
+ */
+vector<account_balance> transaction_db::get_balances() const
+{
+   return accounts;
+}
+
+/**
+ * Returns a copy of applied_transactions, after the ones in base_snapshot. Every id in base_snapshot is older,
+ * so the result stays sorted. Should be valid for RVO.
+ */
+vector<size_t> transaction_db::get_applied_transactions() const
+{
+   std::vector<size_t> applied;
+   if (base_snapshot) {
+      applied.reserve(base_snapshot->applied().size() + applied_transactions.size());
+      applied.assign(base_snapshot->applied().begin(), base_snapshot->applied().end());
+   }
+   applied.insert(applied.end(), applied_transactions.begin(), applied_transactions.end());
+   return applied;
+}
+
+/**
+ * @brief Rolls back transaction based on the transaction_log.
+ *
+ * All values from tlog will exist in database.
+ */
+void transaction_db::rollback(const transaction_log& tlog)
+{
+   rollback(tlog, negative_accounts);
+}
+
+void transaction_db::rollback(const transaction_log& tlog, std::vector<size_t>& negatives)
+{
+   for (const auto& t: tlog) {
+      accounts[t.account_id].balance -= t.balance; 
+      update_negative(t.account_id, negatives);
+   }
+}
+
+/**
+ * @return number of account_id's that have a negative balance AFTER a simulated rollback of t.
+ *
+ * Starts from the given count and only adjusts it for the accounts in t, since no other account changes. Counts like
+ * simulate_rollback() through negative_change(), without the sums the default greedy policy doesn't need.
+ *
+ * @param t       A rollback of t is simulated.
+ * @param invalid Negative accounts before the rollback.
+ */
+size_t transaction_db::get_invalid_accounts(const transaction_log& t, const size_t invalid) const
+{
+   size_t invalid_accounts = invalid;
+
+   for (const auto& x: t) {
+      const long long balance = accounts[x.account_id].balance;
+      invalid_accounts += negative_change(balance, balance - x.balance);
+   }
+   return invalid_accounts;
+}
+
+/**
+ * Same count as get_invalid_accounts(t, invalid), with the deficit and volume summed up along the way.
+ */
+transaction_db::rollback_effect transaction_db::simulate_rollback(const transaction_log& t, const size_t invalid) const
+{
+   rollback_effect effect{invalid, 0, 0};
+
+   for (const auto& x: t) {
+      const long long balance = accounts[x.account_id].balance;
+      const long long new_difference = balance - x.balance;
+      effect.invalid += negative_change(balance, new_difference);
+      effect.repaired += std::max(0ll, -balance) - std::max(0ll, -new_difference);
+      effect.volume += std::max(0, x.balance);
+   }
+   return effect;
+}
+
+/**
+ * Policy is a constant, every branch on it but one folds away. The other policies share one simulate_rollback() pass
+ * and only differ in what goes where in rollback_score. invalid_accounts only needs the count, get_invalid_accounts(), and
+ * ranks by (invalid accounts, id) exactly like greedy did before there were policies.
+ */
+template<greedy_score Policy>
+transaction_db::rollback_score transaction_db::score_rollback(const transaction_log& t, const size_t invalid) const
+{
+   const size_t id = t.get_transaction_id();
+   if (Policy == greedy_score::invalid_accounts) {
+      return {static_cast<double>(get_invalid_accounts(t, invalid)), 0, id};
+   }
+
+   const rollback_effect effect = simulate_rollback(t, invalid);
+   const long long invalid_left = static_cast<long long>(effect.invalid);
+   if (Policy == greedy_score::deficit) {
+      return {static_cast<double>(-effect.repaired), invalid_left, id};
+   }
+   if (Policy == greedy_score::repair_per_volume) {
+      // a transaction moving nothing changes no balance, it repairs nothing either
+      return {effect.volume > 0 ? -static_cast<double>(effect.repaired) / effect.volume : 0.0, invalid_left, id};
+   }
+   return {effect.repaired > 0 ? static_cast<double>(t.transfer_count()) : std::numeric_limits<double>::max(), -effect.repaired, id};
+}
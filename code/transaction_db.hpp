@@ -0,0 +1,1310 @@
+#ifndef TRANSACTION_DB_HPP
+#define TRANSACTION_DB_HPP
+
+#include <map>
+#include <set>
+#include <chrono>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <memory>
+#include <new>
+
+#include "db_stats.hpp"
+#include "thread_pool.hpp"
+
+struct account_balance {
+   int    account_id; ///< the name of the account
+   int    balance; ///< the balance of the account
+};
+
+struct transfer {
+   int from;    ///< the account to transfer from
+   int to;      ///< the account to transfer to
+   int amount;  ///< the amount to transfer
+};
+
+using transaction = std::vector<transfer>;
+
+/**
+ * @brief Non-owning view of a contiguous array. Stand-in for C++20's std::span.
+ */
+template<typename T>
+class array_view {
+public:
+   array_view(): first(nullptr), count(0) {}
+   array_view(T* first, const size_t count): first(first), count(count) {}
+
+   template<typename Allocator>
+   array_view(const std::vector<typename std::remove_const<T>::type, Allocator>& v): first(v.data()), count(v.size()) {}
+
+   T* begin() const { return first; }
+   T* end() const { return first + count; }
+   size_t size() const { return count; }
+   bool empty() const { return count == 0; }
+   T& operator[](const size_t i) const { return first[i]; }
+
+private:
+   T* first;
+   size_t count;
+};
+
+/**
+ * @brief Outcome of pushing one transaction with transaction_db::push_transactions.
+ */
+enum class push_status : char {
+   accepted,       ///< applied and pending until the next settle
+   invalid_account ///< a transfer used an account the validation policy rejected, nothing was applied
+};
+
+/**
+ * @brief Bump allocator for everything that only lives until the next settle.
+ *
+ *        Memory is handed out from large blocks and never freed one allocation at a time.
+ *        reset() rewinds to the first block in O(1) and keeps every block for the next epoch, so a long running
+ *        process stops calling malloc/free per transaction once the blocks are warm, and the heap doesn't fragment.
+ *
+ *        Destructors are not run on reset(). Only objects whose memory also comes from the arena (or that own nothing) belong here.
+ */
+class log_arena {
+public:
+   /**
+    * @param block_size Size of each block. Allocations bigger than this get a block of their own.
+    */
+   explicit log_arena(const size_t block_size = 64 * 1024): block_size(block_size), current(0), cursor(nullptr), limit(nullptr) {}
+
+   log_arena(const log_arena&) = delete;
+   log_arena& operator=(const log_arena&) = delete;
+
+   /**
+    * @return bytes of memory aligned to align. Never returns nullptr.
+    */
+   void* allocate(const size_t bytes, const size_t align);
+
+   /**
+    * @brief Makes all memory handed out so far available again. O(1).
+    */
+   void reset();
+
+   /**
+    * @brief Takes over every block of other. Memory other handed out stays valid and is only reused after the next
+    *        reset(), like memory handed out here. other is left empty.
+    */
+   void adopt(log_arena& other);
+
+private:
+   struct block {
+      std::unique_ptr<char[]> memory;
+      size_t size;
+   };
+
+   const size_t block_size; ///< default size of a new block
+   std::vector<block> blocks; ///< every block ever allocated, reused in order after reset()
+   size_t current; ///< index of the block cursor points into
+   char* cursor; ///< next free byte
+   char* limit; ///< end of the current block
+};
+
+/**
+ * @brief Standard allocator adapter for log_arena. Deallocation is a no-op, memory is returned by log_arena::reset().
+ *        A default constructed allocator has no arena and falls back to the global heap.
+ */
+template<typename T>
+class arena_allocator {
+public:
+   using value_type = T;
+
+   arena_allocator(log_arena* arena = nullptr): arena(arena) {}
+
+   template<typename U>
+   arena_allocator(const arena_allocator<U>& other): arena(other.get_arena()) {}
+
+   T* allocate(const size_t n) {
+      if (arena) {
+         return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+      }
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+   }
+
+   void deallocate(T* p, size_t) {
+      if (!arena) {
+         ::operator delete(p);
+      }
+   }
+
+   log_arena* get_arena() const { return arena; }
+
+private:
+   log_arena* arena; ///< where memory comes from, nullptr for the heap
+};
+
+template<typename T, typename U>
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.get_arena() == b.get_arena(); }
+
+template<typename T, typename U>
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return !(a == b); }
+
+
+/**
+ * @brief Stores the net change for each account in a transaction.
+ *        If a transfer is invalid, then an std::invalid_argument error is thrown. 
+ *        This exception is caught by transaction_db in push_transaction.
+ * 
+ *        transfer {1, 2, 5} equates to account_balance {1, -5} and account_balance {2, 5}.
+ *        The account_id's stored in the log are whatever validate rewrote them to. transaction_db uses its dense account indices.
+ *         For larger transactions and number of accounts, this method reduces spacial needs and time required to iterate through.
+ *
+ *        Constructor throws std::invalid_argument if input is bad.
+ *        Enforces the concept of being atomic by only allowing the constructor to build the log.
+ *
+ *        Entries are kept sorted by account in a flat array. The first inline_capacity entries live inside the log itself,
+ *        so building a log for a typical 2-6 account transaction does not allocate. Bigger transactions spill to the heap,
+ *        or to a log_arena if one is given.
+ *
+ * Reasons:
+ *    Condenses a transaction into a state where the total number of entries is the  number of accounts used.
+ *       *Let there be M transfers with N unique accounts -> Only N entries will be stored.
+ *       *Fasciliates faster settle[ing] because totals are already calculated per account; no need to iterate through all transfer to find total.
+ *
+ *    Average case has less entries to process for rollback. (Only cases for really small transactions might be faster, but those aren't practical or a true concern). 
+ *    Used to verify a transaction before marking changes in the database.
+ *    Beneficial spacially and temporally. 
+ */
+class transaction_log {
+public:
+   using const_iterator = const account_balance*;
+
+   static constexpr size_t inline_capacity = 6; ///< entries stored without allocating
+
+   /**
+    * @brief   Builds the transaction log. Reinforces idea that a transaction is atomic and can't change.
+    * @param   t Transaction used to build the log.
+    * @param   trans_id ID used to keep track of each transaction. Stored if transaction is used when the database is settled.
+    * @param   validate Callable bool(transfer&) used to verify that a transfer is valid. May rewrite the from and to account of its
+    *                   (copied) argument, which is what gets stored in the log. Only used during construction.
+    *                   Taken as a template parameter so the check inlines into build_log, see the validation policies below.
+    * @param   arena Where spilled entries are allocated. nullptr uses the heap.
+    *
+    * @throw   std::invalid_argument If a transfer is "invalid". Invalid currently means that the from and to account do not exist.
+    */
+   template<typename Validator>
+   explicit transaction_log(const transaction& t, const size_t trans_id, Validator validate, log_arena* arena = nullptr);
+
+   /**
+    * @return const_iterator to the beginning of the log.
+    */
+   const_iterator begin()  const { return data(); }
+
+   /**
+    * @return const_iterator to the end of the log.
+    */
+   const_iterator end()    const { return data() + count; }
+
+   /**
+    * @return number of accounts changed by the transaction.
+    */
+   size_t size() const { return count; }
+
+   size_t get_transaction_id() const { return transaction_id; }
+
+   /**
+    * @return number of transfers the log was built from, before they were folded per account.
+    */
+   size_t transfer_count() const { return transfers; }
+
+   /**
+    * @return True if account_id is exists, false otherwise.
+    */
+   bool transfer_exists(const int account_id) const { return find(account_id) != end(); }
+
+   /**
+    * @return the net change for an account if it exists, 0 otherwise.
+    */
+   int net_change(const int account_id) const;
+
+   /**
+    * @brief Outputs all transfers within this transaction to stdout
+    */
+   void dump() const {
+      for (const auto& x: *this) {
+         std::cout << "account: " << x.account_id << "\tbalance: " << x.balance << std::endl;
+      }
+   };
+
+private:
+   const size_t transaction_id; ///< stores the unique id given to the transaction
+   const size_t transfers; ///< see transfer_count()
+   size_t count; ///< number of entries in the log
+   account_balance inline_log[inline_capacity]; ///< log used while the transaction touches at most inline_capacity accounts
+   std::vector<account_balance, arena_allocator<account_balance>> spilled_log; ///< log used once it outgrows inline_log
+
+   /**
+    * @return the entries of the log, sorted by account_id.
+    */
+   account_balance* data() { return count > inline_capacity ? spilled_log.data() : inline_log; }
+   const account_balance* data() const { return count > inline_capacity ? spilled_log.data() : inline_log; }
+
+   /**
+    * @return entry for account_id, end() if it isn't in the log.
+    */
+   const_iterator find(const int account_id) const;
+
+   /**
+    * @brief Builds the log.
+    * @throw std::invalid_argument
+    */
+   template<typename Validator>
+   void build_log(const transaction& t, Validator& validate_transfer);
+
+   /**
+    * @brief Adds a transfer to the log.
+    */
+   void add_to_log(const transfer& xfer);
+
+   /**
+    * @brief Adds change to account_id's entry, creating it in sorted position if needed.
+    */
+   void add_change(const int account_id, const int change);
+};
+
+/**
+ * Builds a transaction log and sets related varaibles.
+ * Will not catch exception thrown from build_log. This is to be handled from wherever the transaction_log constructor is called.
+ */
+template<typename Validator>
+transaction_log::transaction_log(const transaction& t, const size_t trans_id, Validator validate, log_arena* arena): 
+                                 transaction_id(trans_id), transfers(t.size()), count(0), spilled_log(arena_allocator<account_balance>(arena))
+{
+   build_log(t, validate);
+}
+
+
+/**
+ * Iterates through all transfers in transaction and adds them to the log.
+ * It aborts and throws std::invalid_arugment if a transfer is found to be invalid.
+ */
+template<typename Validator>
+void transaction_log::build_log(const transaction& t, Validator& validate_transfer)
+{
+   for (auto xfer: t) {
+      // if a single transfer is bad then drop the entire transaction because a transaction is atomic.
+      if (!validate_transfer(xfer)) {
+         throw std::invalid_argument("Account does not exist.");
+      }
+
+      // if this succeeds then add the valid transfer to the log
+      add_to_log(xfer);
+   }
+}
+
+/**
+ * @brief Strategy used by transaction_db::settle() to choose which transactions to roll back.
+ *
+ *    greedy            Repeatedly rolls back the transaction with the fewest simulated invalid accounts. Fast, but not optimal.
+ *    branch_and_bound  Finds the largest set of surviving transactions. Exact, but worst case is still exponential, so a
+ *                      scope whose search runs past set_exact_node_limit() is settled greedily instead.
+ *    forward           Replays the pending transactions in id order from the settled balances and keeps each one that
+ *                      leaves no account negative. One that doesn't waits in a lookahead window for a later transaction
+ *                      to make room for it. A single pass with bounded work per transaction, see set_forward_window().
+ *    beam              Greedy that looks ahead: searches a few rollbacks deep, keeping the best few partial states at
+ *                      every step, before it commits to one. Between greedy and branch_and_bound in both quality and
+ *                      time, see set_beam().
+ */
+enum class settle_mode {
+   greedy,
+   branch_and_bound,
+   forward,
+   beam
+};
+
+/**
+ * @brief What settle_mode::greedy rolls back every round, among the transactions touching a negative account.
+ *        The deficit is the sum of the negative balances, counted as a positive number. Ties go to the oldest transaction.
+ *
+ *    invalid_accounts   Fewest negative accounts left. Blind to how deep they are.
+ *    deficit            Smallest deficit left, then fewest negative accounts left.
+ *    repair_per_volume  Most deficit repaired per unit of money the transaction moves, so a big transaction has to fix
+ *                       proportionally more to be thrown away. Then fewest negative accounts left.
+ *    fewest_transfers   Fewest transfers thrown away among the transactions that repair some deficit, then most deficit
+ *                       repaired. The ones that repair nothing come last.
+ */
+enum class greedy_score {
+   invalid_accounts,
+   deficit,
+   repair_per_volume,
+   fewest_transfers
+};
+
+/**
+ * @brief When transaction_db::attach_wal() syncs the write-ahead log to disk. Later values are safer and slower.
+ *
+ *    none    Written to the file at every settle and whenever a group of pushes fills up, never synced.
+ *            Survives the process dying, not the machine.
+ *    settle  Also synced at every settle. Pushes since the last full group can be lost, settles can't.
+ *    push    Written and synced before every push call returns. A push_transactions batch shares one sync.
+ */
+enum class wal_sync {
+   none,
+   settle,
+   push
+};
+
+/**
+ * @brief Which version transaction_db::read_balances() hands out.
+ *
+ *    settled  State after the last settle.
+ *    current  State the last time the database published one, pending transactions included. See publish_balances().
+ */
+enum class read_view {
+   settled,
+   current
+};
+
+class write_ahead_log;
+class wal_reader;
+class checkpointer;
+class snapshot_reader;
+class epoch_domain;
+struct state_view;
+struct published_views;
+struct ingest_state;
+
+/**
+ * @brief One version of the balances, pinned for as long as this object lives. See transaction_db::read_balances().
+ *        Holding one never blocks the database, it only keeps that version from being freed.
+ *        Has to be released before the database it came from is destroyed.
+ */
+class read_snapshot {
+public:
+   read_snapshot(read_snapshot&& other);
+   ~read_snapshot();
+
+   read_snapshot(const read_snapshot&) = delete;
+   read_snapshot& operator=(const read_snapshot&) = delete;
+   read_snapshot& operator=(read_snapshot&&) = delete;
+
+   /**
+    * @return balances in the same order as transaction_db::get_balances().
+    */
+   std::vector<account_balance> get_balances() const;
+
+   /**
+    * @return transactions applied by the settles this version includes, ascending.
+    */
+   std::vector<size_t> get_applied_transactions() const;
+
+   /**
+    * @return id the next pushed transaction would get, so every transaction below it is part of this version.
+    */
+   size_t next_transaction() const;
+
+   /**
+    * @return false if pending transactions are applied to the balances.
+    */
+   bool is_settled() const;
+
+private:
+   friend class transaction_db;
+
+   read_snapshot(epoch_domain* epochs, const size_t slot, const state_view* view);
+
+   epoch_domain* epochs; ///< nullptr once moved from
+   size_t slot;
+   const state_view* view;
+};
+
+/**
+ * @brief Finds the smallest set of pending transactions that must be rolled back so no account is negative.
+ *
+ *        Only the final state has to be valid, so the order transactions are rolled back in does not matter.
+ *        This turns the problem into picking a subset, which is searched with branch-and-bound:
+ *
+ *    Branching: Pick a negative account. At least one undecided transaction that took money out of it has to be dropped.
+ *               Branch i drops the i-th such transaction and keeps the ones before it, so no drop set is visited twice.
+ *    Bounding:  An upper bound on surviving transactions is (undecided + kept) minus the fewest extra drops that could
+ *               possibly fix the state. Two admissible estimates are used for that and the larger one is taken:
+ *                  *For each negative account, the fewest of its helpers whose repairs cover its deficit.
+ *                   These are summed over accounts that don't share an undecided helper, since one drop can't count twice.
+ *                  *The fewest undecided transactions whose total repairs cover the total deficit.
+ *               If the bound can't beat the best solution found so far, then the branch is pruned.
+ *    Splitting: An account is safe if it stays >= 0 even when every undecided transaction paying into it is dropped.
+ *               Transactions that only share safe accounts can't affect each other, so the undecided transactions are
+ *               grouped by the unsafe accounts they share and every group with a negative account is solved on its own.
+ *               Without this, independent problems get multiplied together instead of added.
+ *
+ *        Some accounts can't be repaired whatever is dropped. Those are left out of what has to end up >= 0, see solve(),
+ *        and the search fixes everything else.
+ *
+ *        Works on a local copy of the balances of every account touched by a pending transaction.
+ */
+class exact_settler {
+public:
+   /**
+    * @param logs       Pending transactions. Index in this vector is used as the transaction's id inside the search.
+    * @param balance_of Returns the current database balance of an account.
+    * @param node_limit Search nodes solve() may visit before it gives up, see ran_out_of_nodes().
+    */
+   exact_settler(const std::vector<const transaction_log*>& logs, const std::function<int(int account_id)>& balance_of,
+                 const size_t node_limit = npos);
+
+   /**
+    * @brief Runs the search.
+    * @return dropped[i] is true if logs[i] must be rolled back.
+    *         Accounts that can't be repaired stay negative, the rest end up >= 0.
+    */
+   std::vector<bool> solve();
+
+   /**
+    * @return number of search nodes visited by solve().
+    */
+   size_t nodes_searched() const { return nodes; }
+
+   /**
+    * @return true if solve() gave up at node_limit. It drops nothing then.
+    */
+   bool ran_out_of_nodes() const { return nodes > node_limit; }
+
+private:
+   enum class decision : char { undecided, keep, drop };
+
+   struct entry {
+      size_t account; ///< local index of the account
+      int    change;  ///< net change of the account in the transaction
+   };
+
+   struct helper {
+      size_t log;    ///< index of the transaction
+      int    repair; ///< amount given back to the account if the transaction is dropped
+   };
+
+   std::vector<std::vector<entry>> log_entries; ///< net changes of each transaction, using local account indices
+   std::vector<std::vector<helper>> helpers;    ///< per account, transactions that withdrew from it. Sorted by largest repair first
+   std::vector<long long> total_repair;         ///< sum of all withdrawals in a transaction
+   std::vector<long long> balances;             ///< local balances, updated as transactions are dropped
+   std::vector<decision> state;                 ///< decision made for every transaction in the current branch
+   std::vector<size_t> scope_of;                ///< per account, the sub problem its negative balance belongs to
+   size_t next_scope;                           ///< id handed to the next sub problem
+   size_t nodes;                                ///< calls to search(), reported through nodes_searched()
+   const size_t node_limit;                     ///< see ran_out_of_nodes()
+
+   std::vector<size_t> negatives;               ///< local accounts that are currently negative and have to be fixed
+   std::vector<size_t> negative_pos;            ///< position of an account in negatives, npos if it is not in there
+   std::vector<char> left_out;                  ///< per account, true if it can't be repaired and is never in negatives
+
+   std::vector<std::pair<size_t, size_t>> required; ///< scratch for lower_bound(), (helpers needed, account)
+   std::vector<size_t> claimed;                     ///< scratch for lower_bound(), stamp of the last pass that used a transaction
+   size_t stamp;                                    ///< current lower_bound() pass
+   std::vector<long long> credit;                   ///< scratch for split(), money paid into an account by undecided transactions
+   std::vector<size_t> owner;                       ///< scratch for split(), first transaction seen touching an unsafe account
+   std::vector<size_t> parent;                      ///< scratch for split(), union-find over positions in the scope
+
+   static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+   size_t search(const std::vector<size_t>& scope, size_t id, size_t limit, std::vector<size_t>& dropped);
+   size_t lower_bound(const std::vector<size_t>& scope, size_t id);
+   void split(const std::vector<size_t>& scope, std::vector<std::vector<size_t>>& parts);
+   size_t find(size_t x);
+   void drop(size_t log);
+   void undrop(size_t log);
+   void update_negative(size_t account);
+   void leave_out(size_t account);
+};
+
+/**
+ * @brief Validation policies for transaction_db::push_transaction.
+ *        A policy checks a transfer and rewrites its accounts to the database's dense indices.
+ *        It is a template parameter all the way down to transaction_log::build_log, so each deployment pays for an inlined check instead of a std::function call.
+ *
+ *    accounts_must_exist      Both accounts must already be in the database. This is the default.
+ *    auto_create_accounts     Unknown accounts are created with a balance of 0.
+ *    range_checked_dense_ids  account_id's are already dense indices, so the hash lookup is replaced by a range check.
+ *                             Only valid when the database was built from account_id's 0..N-1 in order, the constructor throws std::logic_error otherwise.
+ */
+class transaction_db;
+
+class accounts_must_exist {
+public:
+   explicit accounts_must_exist(transaction_db& db): db(db) {}
+   bool operator()(transfer& xfer) const;
+
+private:
+   const transaction_db& db;
+};
+
+class auto_create_accounts {
+public:
+   explicit auto_create_accounts(transaction_db& db): db(db) {}
+   bool operator()(transfer& xfer) const;
+
+private:
+   transaction_db& db;
+};
+
+class range_checked_dense_ids {
+public:
+   explicit range_checked_dense_ids(transaction_db& db);
+   bool operator()(transfer& xfer) const { return in_range(xfer.from) && in_range(xfer.to); }
+
+private:
+   const size_t account_count;
+
+   bool in_range(const int account_id) const { return account_id >= 0 && static_cast<size_t>(account_id) < account_count; }
+};
+
+/**
+ * @brief Transactional database implementation. Follows ACID properties.
+ *
+ * 
+ * All transactions must be atomic.
+ * A "settle[d]" state cannot contain an account with a negative balance.
+ *
+ * Accounts are stored densely in a vector.
+ *    * External account_id's are mapped to an index once, when a transaction is pushed.
+ *    * Everything after that (apply, rollback, settle) is plain array indexing instead of chasing hash nodes.
+ *    * Order is not important.
+ * 
+ * 
+ * Variables:
+ *    current_transaction keeps track of the most recent transaction
+ *    accounts is a vector indexed by dense account index, each entry still carries its external account_id for get_balances()
+ *    account_index maps external account_id's to dense indices. Only used to validate and remap pushed transactions
+ *    temp_log is a vector in transaction id order. Pending ids are contiguous, so an id is found by offsetting from first_pending.
+ *       Rolled back transactions are set to nullptr instead of erased, since the algorithm commonly removes elements from the "middle".
+ *       The logs themselves live in arena, which is reset after every settle.
+ *    applied_transactions is a set to enforce that there is a unique transaction id and will always remain ordered
+ *    negative_accounts is kept up to date by apply_transaction and rollback so settle can check for invalid accounts in O(1)
+ *    pending_by_account lets settle only look at transactions that touch a negative account
+ *    stats counts what push and settle did, see get_stats()
+ *    pool settles independent scopes in parallel and scores the candidates of big greedy rounds, see set_settle_threads()
+ *    wal records pushes, new accounts and settle outcomes when attached, see attach_wal() and recover()
+ *    snapshots writes the settled state in the background, see enable_snapshots(). A database loaded from one keeps it
+ *       mapped as base_snapshot, and applied_transactions only holds what was committed since
+ *    readers holds the versions other threads read through read_balances(). Snapshots and readers share copy-on-write
+ *       views: dirty_pages and unviewed_applied say what changed since latest_view, so the next one only copies that
+ *    ingest is what producer threads share between begin_ingest() and end_ingest(), see ingest_state
+ */
+class transaction_db {
+public:
+
+   /**
+    * @brief Builds the initial database state from initial_balances.
+    */
+   explicit transaction_db(const std::vector<account_balance>& initial_balances);
+   ~transaction_db();
+
+   transaction_db(transaction_db&&);
+   transaction_db& operator=(transaction_db&&);
+
+   /**
+    * @brief Pushes a transaction and loads it into the database. If a single transfer is invalid, then the entire transaction is drooped.
+    * @tparam Validator Validation policy, see accounts_must_exist.
+    */
+   template<typename Validator = accounts_must_exist>
+   void push_transaction(const transaction& t);
+
+   /**
+    * @brief Pushes a batch of transactions in order. Same as calling push_transaction for each one,
+    *        except rejections are reported instead of printed and nothing throws for bad input.
+    * @tparam Validator Validation policy, see accounts_must_exist.
+    * @return status of every transaction in batch, in the same order.
+    */
+   template<typename Validator = accounts_must_exist>
+   std::vector<push_status> push_transactions(array_view<const transaction> batch);
+
+   /**
+    * @brief Commits changes and ensures the database is in a valid state.
+    * Valid is defined as all accounts having a balance greater than 0.
+    * Uses the strategy selected by set_settle_mode().
+    */
+   void settle();
+
+   /**
+    * @brief Anytime settle, for when settling has to finish in time rather than drop as few transactions as possible.
+    *        Ignores set_settle_mode(). Every scope first gets a forward settle, which is linear in its transactions, and
+    *        then keeps improving it with local search until deadline: dropped transactions that fit again are put back,
+    *        and a kept transaction is swapped for a dropped one when that makes room for more. Only moves that keep
+    *        every balance valid and keep more transactions are taken, so whatever the search holds when time runs out
+    *        is the best it has found, and that is committed.
+    *
+    *        The forward pass always runs, even past deadline, and a move that started is finished, so settle can
+    *        overrun deadline by that much.
+    */
+   void settle(const std::chrono::steady_clock::time_point deadline);
+
+   /**
+    * @brief Selects the strategy used by settle(). Defaults to settle_mode::greedy.
+    */
+   void set_settle_mode(const settle_mode mode) { current_mode = mode; }
+
+   /**
+    * @return strategy currently used by settle().
+    */
+   settle_mode get_settle_mode() const { return current_mode; }
+
+   /**
+    * @brief Sets how many later transactions settle_mode::forward waits for one that didn't fit, before dropping it.
+    *        0 keeps exactly the transactions that fit when their turn comes. Defaults to default_forward_window.
+    */
+   void set_forward_window(const size_t window) { forward_window = window; }
+
+   size_t get_forward_window() const { return forward_window; }
+
+   /**
+    * @brief Selects how settle_mode::greedy picks the transaction it rolls back. Defaults to greedy_score::invalid_accounts.
+    */
+   void set_greedy_score(const greedy_score score) { greedy_policy = score; }
+
+   greedy_score get_greedy_score() const { return greedy_policy; }
+
+   /**
+    * @brief Sets the search settle_mode::beam does before every rollback. Width 1 and depth 1 is a greedy settle that
+    *        scores by negative balance left instead of negative accounts left. Defaults to default_beam_width and
+    *        default_beam_depth.
+    * @param width Partial states kept at every step.
+    * @param depth Rollbacks looked ahead before the first one is committed.
+    * @throw std::invalid_argument if width or depth is 0.
+    */
+   void set_beam(const size_t width, const size_t depth);
+
+   size_t get_beam_width() const { return beam_width; }
+   size_t get_beam_depth() const { return beam_depth; }
+
+   /**
+    * @brief Sets how many search nodes settle_mode::branch_and_bound may visit per scope. A scope that needs more is
+    *        settled greedily, and counted in settle_stats::exact_fallbacks. Defaults to default_exact_node_limit.
+    */
+   void set_exact_node_limit(const size_t nodes) { exact_node_limit = nodes; }
+
+   size_t get_exact_node_limit() const { return exact_node_limit; }
+
+   /**
+    * @brief Sets how many threads the greedy settle scores candidates on. 1, the default, scores on the calling thread only.
+    * @param threads Threads counting the caller, 0 means one per hardware thread.
+    * @param min_parallel_candidates Scopes with fewer candidates than this are scored serially, where waking the pool
+    *                                would cost more than it saves.
+    */
+   void set_settle_threads(size_t threads, const size_t min_parallel_candidates = default_parallel_candidates);
+
+   /**
+    * @return threads used to score candidates, counting the caller.
+    */
+   size_t get_settle_threads() const { return pool ? pool->size() : 1; }
+
+   /**
+    * @return std::vector<account_balance> of current accounts.
+    */
+   std::vector<account_balance> get_balances() const;
+
+   /**
+    * @return std::vector<size_t> of all vectors that have been commited and used after a call to settle()
+    */
+   std::vector<size_t> get_applied_transactions() const;
+
+   /**
+    * @brief Rolls back transaction based on the transaction_log.
+    */
+    void rollback(const transaction_log& tlog);
+
+   /**
+    * @return push and settle counters since construction or the last reset_stats().
+    */
+   const transaction_db_stats& get_stats() const { return stats; }
+
+   /**
+    * @brief Zeroes every counter and histogram.
+    */
+   void reset_stats() { stats = transaction_db_stats(); }
+
+   /**
+    * @brief Starts a new write-ahead log at path, replacing any file there. The log opens with the current balances and
+    *        applied transactions, then records every push, new account and settle from here on.
+    * @param group_bytes Pushes are written to the file in groups of about this many bytes, see write_ahead_log.
+    * @throw std::logic_error If transactions are pending, the log has no way to record them.
+    * @throw std::runtime_error If the file can't be written.
+    */
+   void attach_wal(const char* path, const wal_sync sync = wal_sync::settle, const size_t group_bytes = default_wal_group_bytes);
+
+   /**
+    * @brief Rebuilds a database from a write-ahead log. Accounts, applied transactions and the transactions pushed since
+    *        the last settle come back as they were, and the log stays attached so new changes append to it.
+    *        Anything after the last intact record is cut off.
+    * @throw std::runtime_error If the file isn't a write-ahead log or its records contradict each other.
+    */
+   static transaction_db recover(const char* path, const wal_sync sync = wal_sync::settle, const size_t group_bytes = default_wal_group_bytes);
+
+   /**
+    * @brief Same as recover(path), but starts from the snapshot at snapshot_path and only replays the log past the
+    *        last record it includes, so it costs the account count plus what happened since. Falls back to the whole
+    *        log if there is no file at snapshot_path.
+    * @throw std::runtime_error If the snapshot wasn't taken from this log.
+    */
+   static transaction_db recover(const char* path, const char* snapshot_path, const wal_sync sync = wal_sync::settle,
+                                 const size_t group_bytes = default_wal_group_bytes);
+
+   /**
+    * @brief Builds a database from a snapshot. The file is mapped and stays mapped, applied transactions are read
+    *        straight out of it instead of being copied, so only the accounts cost anything to load.
+    * @throw std::runtime_error If the file isn't a snapshot.
+    */
+   static transaction_db load_snapshot(const char* path);
+
+   /**
+    * @brief Writes a snapshot of the settled state to path after every every_settles settles. The snapshot is written
+    *        by a background thread from a copy-on-write view, see state_view, so settle only pays for the accounts it touched.
+    *        With a write-ahead log attached, the snapshot remembers where in the log it was taken.
+    */
+   void enable_snapshots(const char* path, const size_t every_settles = 1);
+
+   /**
+    * @brief Blocks until the last snapshot handed to the background thread is on disk.
+    * @throw std::runtime_error If writing a snapshot failed.
+    */
+   void wait_for_snapshot();
+
+   /**
+    * @brief Starts publishing versions for read_balances(). Every settle publishes the settled state from then on.
+    *        Call before any reader starts.
+    * @param max_readers Snapshots that can be held at once, read_balances() waits for one to be released past that.
+    */
+   void enable_read_snapshots(const size_t max_readers = default_max_readers);
+
+   /**
+    * @brief Publishes the balances as they are right now, pending transactions included, as read_view::current.
+    *        Costs the pages touched since the last version.
+    * @throw std::logic_error If enable_read_snapshots() wasn't called.
+    */
+   void publish_balances();
+
+   /**
+    * @brief Pins the latest published version of which. Safe to call from any thread, also while this database pushes
+    *        or settles: it reads one atomic pointer and claims a slot of its own, so neither side waits for the other.
+    *        Old versions are freed with epoch-based reclamation once no snapshot pins them, see epoch_domain.
+    * @throw std::logic_error If enable_read_snapshots() wasn't called.
+    */
+   read_snapshot read_balances(const read_view which = read_view::settled) const;
+
+   /**
+    * @brief Opens the database to ingest_transaction() from many threads at once. Until end_ingest(), nothing but
+    *        ingest_transaction() and read_balances() may be called.
+    * @param producers Threads expected to push at once, 0 means one per hardware thread. Only sizes the sharding.
+    * @throw std::logic_error If a write-ahead log is attached, it records pushes in order from one thread.
+    */
+   void begin_ingest(size_t producers = 0);
+
+   /**
+    * @brief push_transactions() for a single transaction, safe to call from any number of threads between
+    *        begin_ingest() and end_ingest(). Accepted transactions get their id from an atomic ticket, so ids are
+    *        still dense and in one total order. Balances are updated under per account stripe locks.
+    * @tparam Validator Validation policy, see accounts_must_exist. auto_create_accounts can't be used, producers
+    *                   share the account index without a lock.
+    * @throw std::logic_error If begin_ingest() wasn't called.
+    */
+   template<typename Validator = accounts_must_exist>
+   push_status ingest_transaction(const transaction& t);
+
+   /**
+    * @brief Closes the ingest. Every ingest_transaction() call must have returned. Afterwards the database is in the
+    *        same state as if every accepted transaction had been pushed with push_transaction() in id order, so settle()
+    *        does exactly what it would have.
+    * @throw std::logic_error If begin_ingest() wasn't called.
+    */
+   void end_ingest();
+   
+private: 
+   friend class accounts_must_exist;
+   friend class auto_create_accounts;
+   friend class range_checked_dense_ids;
+
+   /**
+    * @brief Applies a validated transaction log and adds it to temp_log.
+    */
+   void add_pending(transaction_log* tlog);
+
+   /**
+    * @brief Hands a pushed transaction to wal, with the account ids it was pushed with. Only called when wal is attached.
+    */
+   void log_push(const transaction& t, const size_t trans_id);
+
+   /**
+    * @brief Lets wal write or sync once a push call is done. Only called when wal is attached.
+    */
+   void end_push();
+
+   /**
+    * @brief The part of ingest_transaction() after validation: takes the ticket, builds the log on this thread's
+    *        shard and applies it stripe by stripe.
+    */
+   void ingest_validated(const transaction& validated_transfers);
+
+   /**
+    * @brief Counts a transaction ingest_transaction() rejected.
+    */
+   void ingest_rejected();
+
+   /**
+    * @brief Replays the records left in reader. See recover().
+    */
+   void replay(wal_reader& reader, const char* path);
+
+   /**
+    * @brief Starts tracking what changed since the last view. The first view built afterwards copies every page.
+    */
+   void start_views();
+
+   /**
+    * @brief Builds a state_view of the balances as they are, sharing every clean page with latest_view.
+    * @param settled Whether this is the end of a commit, with nothing pending.
+    */
+   std::shared_ptr<const state_view> build_view(const bool settled);
+
+   /**
+    * @brief Adds an account with a balance of 0.
+    * @return the dense index of the new account.
+    */
+   size_t add_account(const int account_id);
+
+   /**
+    * @brief Updates database account balances after a transaction has been validated.
+    */
+   void apply_transaction(const transaction_log& tlog);
+
+   /**
+    * @brief Pending transactions connected through shared accounts, directly or through other pending transactions,
+    *        that hold at least one negative account. Rolling back a transaction only changes balances inside its own
+    *        scope, so every scope settles on its own and scopes never touch the same account, log or negative_pos entry.
+    */
+   struct settle_scope {
+      std::vector<size_t> logs;      ///< transaction ids, ascending
+      std::vector<size_t> negatives; ///< the scope's negative accounts, negative_pos holds positions in here while it settles
+      size_t dropped = 0;            ///< transactions rolled back
+      std::uint64_t rounds = 0;
+      std::uint64_t candidates_scored = 0;
+      std::uint64_t exact_fallbacks = 0;
+   };
+
+   /**
+    * @brief Splits the pending transactions into settle_scope's with union-find over shared accounts.
+    *        Scopes without a negative account are valid already and left out. Negative accounts that no pending
+    *        transaction touches can't be fixed, they are all that is left in negative_accounts until merge_scopes().
+    */
+   void partition_pending(std::vector<settle_scope>& scopes);
+
+   /**
+    * @brief Calls settle_one on every scope. Scopes with at least parallel_candidates transactions go one at a time and may
+    *        use pool themselves (second argument true), the rest are spread over pool.
+    */
+   void for_each_scope(std::vector<settle_scope>& scopes, const std::function<void(settle_scope&, bool)>& settle_one);
+
+   /**
+    * @brief Puts the negatives left in scopes back into negative_accounts, updates pending_count and adds the scopes to run.
+    *        Every scope is committed as it settled. One that is still negative has an account nothing pending can fix,
+    *        and that account stays negative.
+    */
+   void merge_scopes(std::vector<settle_scope>& scopes, settle_stats& run);
+
+   /**
+    * @brief What a simulated rollback of a transaction does, everything the greedy_score policies look at.
+    */
+   struct rollback_effect {
+      size_t invalid;     ///< negative accounts left
+      long long repaired; ///< deficit the rollback takes away, negative if it adds some
+      long long volume;   ///< money the transaction moves, the sum of its positive changes
+   };
+
+   /**
+    * @brief get_invalid_accounts(t, invalid) and the rest of rollback_effect in the same pass over t.
+    */
+   rollback_effect simulate_rollback(const transaction_log& t, const size_t invalid) const;
+
+   /**
+    * @return +1 if an account goes negative moving from balance to new_balance, -1 if it stops being negative, else 0.
+    *         Shared by get_invalid_accounts(t, invalid) and simulate_rollback() so they always count alike, in long long.
+    */
+   static int negative_change(const long long balance, const long long new_balance)
+   {
+      return static_cast<int>(new_balance < 0) - static_cast<int>(balance < 0);
+   }
+
+   /**
+    * @brief A candidate's rank under greedy_policy. Smaller is better.
+    */
+   struct rollback_score {
+      double primary;
+      long long secondary;
+      size_t id;
+
+      bool operator<(const rollback_score& other) const {
+         if (primary != other.primary) {
+            return primary < other.primary;
+         }
+         return secondary != other.secondary ? secondary < other.secondary : id < other.id;
+      }
+   };
+
+   /**
+    * @return the rank of rolling back t under Policy. t touches a negative account of a scope.
+    * @param invalid Negative accounts of the scope, or any count that is the same for every score compared with this
+    *                one and at least the negative accounts t touches: each policy ranks the same for all of them.
+    */
+   template<greedy_score Policy>
+   rollback_score score_rollback(const transaction_log& t, const size_t invalid) const;
+
+   /**
+    * @brief Greedy settle. Rolls back the best transaction by greedy_policy until the database is valid.
+    *        Fills in rounds and candidates_scored of run.
+    */
+   void settle_greedy(settle_stats& run);
+
+   /**
+    * @brief Greedy settle of one scope.
+    * @param parallel_scoring Big rounds may be scored on pool. Only true when the scope isn't itself running on pool.
+    */
+   void settle_scope_greedy(settle_scope& scope, const bool parallel_scoring);
+
+   /**
+    * @brief settle_scope_greedy() with the policy fixed at compile time.
+    */
+   template<greedy_score Policy>
+   void settle_scope_greedy(settle_scope& scope, const bool parallel_scoring);
+
+   /**
+    * @brief Scores the first candidates of a big greedy scope on pool.
+    * @param ids Transactions to score.
+    * @param scores Filled with score_rollback<Policy>(ids[i], invalid) at i.
+    */
+   template<greedy_score Policy>
+   void score_candidates_parallel(const std::vector<size_t>& ids, std::vector<rollback_score>& scores, const size_t invalid);
+
+   /**
+    * @return true if tlog touches an account in the negatives of its scope.
+    */
+   bool touches_negative(const transaction_log& tlog) const;
+
+   /**
+    * @brief Forward settle. Replays every scope with a negative account in id order, see settle_mode::forward.
+    *        Fills in rounds and candidates_scored of run.
+    */
+   void settle_forward(settle_stats& run);
+
+   /**
+    * @brief Forward settle of one scope.
+    */
+   void settle_scope_forward(settle_scope& scope);
+
+   /**
+    * @brief Applies the scope's transactions in id order from its settled balances, see settle_scope_forward().
+    *        Leaves negative_pos, scope.negatives and temp_log as they were.
+    * @return positions in scope.logs of the transactions that didn't make it, ascending.
+    */
+   std::vector<size_t> replay_forward(settle_scope& scope);
+
+   /**
+    * @brief Brings scope.negatives up to date after replay_forward(), then drops the transactions at positions.
+    */
+   void drop_replayed(settle_scope& scope, const std::vector<size_t>& positions);
+
+   /**
+    * @brief Beam settle. Rolls back the first step of the best partial state found by a beam search until the database
+    *        is valid, see settle_mode::beam. Fills in rounds and candidates_scored of run.
+    */
+   void settle_beam(settle_stats& run);
+
+   /**
+    * @brief Beam settle of one scope.
+    */
+   void settle_scope_beam(settle_scope& scope);
+
+   /**
+    * @brief A partial state of the beam search: the scope's current state with every rollback on the path to it done.
+    *        Nodes point at their parent, so states one step apart share all but the last rollback.
+    */
+   struct beam_node {
+      size_t parent;         ///< index of the previous step in the same search, npos for the scope's current state
+      size_t id;             ///< transaction rolled back by this step
+      long long deficit;     ///< sum of the negative balances left, as a positive number
+      size_t invalid;        ///< negative accounts left
+      std::uint64_t path_hash; ///< order independent hash of every id on the path, finds the same state reached in another order
+   };
+
+   /**
+    * @brief Rolls back every transaction on the path to node. Undone by restore_beam_path() with the same path.
+    * @param path Filled with the ids on the path, last step first.
+    */
+   void enter_beam_path(const std::vector<beam_node>& nodes, size_t node, std::vector<size_t>& path, settle_scope& scope);
+
+   void restore_beam_path(const std::vector<size_t>& path, settle_scope& scope);
+
+   /**
+    * @brief Anytime settle. A forward settle of every scope with a negative account, improved until deadline.
+    *        Fills in rounds and candidates_scored of run.
+    */
+   void settle_anytime(settle_stats& run, const std::chrono::steady_clock::time_point deadline);
+
+   /**
+    * @brief Anytime settle of one scope.
+    */
+   void settle_scope_anytime(settle_scope& scope, const std::chrono::steady_clock::time_point deadline);
+
+   /**
+    * @brief Local search over one scope after replay_forward(), with every balance of the scope valid.
+    * @param dropped Positions in scope.logs that aren't applied, ascending. Whatever is still dropped at the end.
+    */
+   void improve_scope(settle_scope& scope, std::vector<size_t>& dropped, const std::chrono::steady_clock::time_point deadline);
+
+   /**
+    * @brief Times a settle, runs strategy and records the run in stats.
+    */
+   void run_settle(const std::function<void(settle_stats&)>& strategy);
+
+   /**
+    * @return true if applying tlog leaves no account it takes money from negative.
+    */
+   bool fits(const transaction_log& tlog) const;
+
+   /**
+    * @brief Exact settle. Rolls back the fewest transactions possible, see exact_settler.
+    *        Fills in rounds, candidates_scored and exact_fallbacks of run.
+    */
+   void settle_branch_and_bound(settle_stats& run);
+
+   /**
+    * @brief Exact settle of one scope, or a greedy one if the search runs out of nodes.
+    * @param parallel_scoring Passed on to settle_scope_greedy().
+    */
+   void settle_scope_exact(settle_scope& scope, const bool parallel_scoring);
+
+   /**
+    * @brief Moves every transaction left in temp_log into applied_transactions, clears temp_log and resets arena.
+    *        The outcome is logged to wal first, when one is attached.
+    */
+   void commit();
+
+   /**
+    * @brief Rolls back a pending transaction and removes it from temp_log.
+    */
+   void drop_pending(const size_t trans_id);
+
+   /**
+    * @brief drop_pending() for a transaction of scope. Only touches the scope, pending_count is left to merge_scopes().
+    */
+   void drop_in_scope(settle_scope& scope, const size_t trans_id);
+
+   /**
+    * @brief Rolls back tlog, tracking negative balances in negatives instead of negative_accounts.
+    */
+   void rollback(const transaction_log& tlog, std::vector<size_t>& negatives);
+
+   /**
+    * @brief Adds or removes account from negative_accounts to match its balance.
+    */
+   void update_negative(const size_t account) { update_negative(account, negative_accounts); }
+
+   /**
+    * @brief Adds or removes account from negatives to match its balance. negative_pos must hold positions in negatives.
+    */
+   void update_negative(const size_t account, std::vector<size_t>& negatives);
+
+   /**
+    * @return number of account_id's that have a negative balance from current database.
+    */
+   size_t get_invalid_accounts() const { return negative_accounts.size(); }
+
+   /**
+    * @return number of account_id's that have a negative balance AFTER a simulated rollback of t.
+    *
+    * @param t       A rollback of t is simulated.
+    * @param invalid Negative accounts before the rollback, database wide or within t's scope.
+    */
+   size_t get_invalid_accounts(const transaction_log& t, const size_t invalid) const;
+
+private:
+   size_t current_transaction; ///< the current transaction
+   settle_mode current_mode; ///< strategy used by settle()
+   size_t forward_window; ///< see set_forward_window()
+   greedy_score greedy_policy; ///< see set_greedy_score()
+   size_t beam_width; ///< see set_beam()
+   size_t beam_depth;
+   size_t exact_node_limit; ///< see set_exact_node_limit()
+   std::vector<account_balance> accounts;  ///< the database of accounts, indexed by dense account index
+   std::unordered_map<int, size_t> account_index; ///< external account_id -> index in accounts
+   bool dense_ids; ///< true while every account_id equals its index in accounts
+   std::unique_ptr<log_arena> arena; ///< memory for the pending transaction logs, resets after every settle. Heap allocated so logs keep a valid pointer when the database moves
+   std::vector<transaction_log*> temp_log; ///< resets after every settle, temp_log[i] is transaction first_pending + i. nullptr once rolled back
+   size_t first_pending; ///< transaction id of temp_log[0]
+   size_t pending_count; ///< number of non-null entries in temp_log
+   std::set<size_t> applied_transactions; ///< stores applied transactions and guarantees order
+   std::vector<size_t> negative_accounts; ///< indices of accounts with a balance below 0, unordered
+   std::vector<size_t> negative_pos; ///< position of each account in negative_accounts, npos if it isn't negative
+   std::vector<std::vector<size_t>> pending_by_account; ///< per account, transactions in temp_log that touch it. May hold rolled back ids
+   std::vector<size_t> pending_accounts; ///< accounts with a non-empty list in pending_by_account, so commit doesn't have to visit every account
+   transaction validated; ///< scratch for push_transactions, the transaction being pushed with its accounts remapped
+   transaction_db_stats stats; ///< see get_stats()
+   std::unique_ptr<thread_pool> pool; ///< scores greedy candidates, nullptr when settle runs on one thread
+   size_t parallel_candidates; ///< fewest candidates in a scope worth handing to pool
+   std::vector<size_t> heap_slot; ///< scratch for settle_scope_greedy(), per temp_log position, its place in the scope's indexed_heap
+   std::vector<size_t> rescored_in; ///< scratch for settle_scope_greedy(), per temp_log position, the last round it was rescored in
+   std::vector<size_t> scope_parent; ///< scratch for partition_pending(), union-find over temp_log positions
+   std::vector<size_t> scope_of; ///< scratch for partition_pending(), scope index of each union-find root
+   std::vector<size_t> forward_wanted; ///< scratch for settle_scope_forward(), per account, waiting transactions taking money from it
+   std::unique_ptr<write_ahead_log> wal; ///< nullptr unless attach_wal() or recover() opened one
+   std::shared_ptr<const snapshot_reader> base_snapshot; ///< snapshot this database was loaded from, holds the applied ids older than applied_transactions
+   std::unique_ptr<checkpointer> snapshots; ///< writes snapshots in the background, nullptr unless enable_snapshots()
+   std::unique_ptr<published_views> readers; ///< versions read_balances() hands out, nullptr unless enable_read_snapshots()
+   std::shared_ptr<const state_view> latest_view; ///< last view built for snapshots or readers
+   size_t snapshot_every; ///< settles between snapshots
+   size_t settles_since_snapshot;
+   std::vector<char> dirty_pages; ///< per page of latest_view, whether an account on it changed since. Only kept up with snapshots or readers
+   std::vector<std::uint64_t> unviewed_applied; ///< ids committed since latest_view was built
+   std::unique_ptr<ingest_state> ingest; ///< shared by producer threads, nullptr unless between begin_ingest() and end_ingest()
+
+   static constexpr size_t npos = std::numeric_limits<size_t>::max();
+   static constexpr size_t default_parallel_candidates = 4096;
+   static constexpr size_t default_wal_group_bytes = 64 * 1024;
+   static constexpr size_t default_max_readers = 64;
+   static constexpr size_t default_forward_window = 64;
+   static constexpr size_t default_beam_width = 4;
+   static constexpr size_t default_beam_depth = 3;
+   static constexpr size_t default_exact_node_limit = 10000;
+};
+
+/**
+ * Attemps to build a transaction log. If transaction_log throws then it returns early from the 
+ * c'tor and is not applied to the database.
+
+ * When transaction_log succeeds, t is applied to the database and the transaction log pushed into the temp_log.
+ */
+template<typename Validator>
+void transaction_db::push_transaction(const transaction& t)
+{
+   Validator validate(*this);
+
+   transaction_log* xction_ptr = nullptr; // only declared here for scope reasons
+   try {
+      void* memory = arena->allocate(sizeof(transaction_log), alignof(transaction_log));
+      xction_ptr = new (memory) transaction_log(t, current_transaction, validate, arena.get());
+   } catch (std::exception &e) {
+      std::cerr << e.what();
+      ++stats.rejected_transactions;
+      return; // exit early
+   }
+   add_pending(xction_ptr);
+   ++stats.accepted_transactions;
+   stats.validated_transfers += t.size();
+   if (wal) {
+      log_push(t, current_transaction - 1);
+      end_push();
+   }
+}
+
+/**
+ * Every transaction is validated into the validated scratch buffer first. Only if all of its transfers pass is the log built,
+ * from the already remapped transfers, so building can't throw and no exception is used for control flow.
+ * temp_log is reserved for the whole batch up front.
+ */
+template<typename Validator>
+std::vector<push_status> transaction_db::push_transactions(array_view<const transaction> batch)
+{
+   Validator validate(*this);
+   auto accept = [](transfer&) { return true; };
+
+   std::vector<push_status> status;
+   status.reserve(batch.size());
+   temp_log.reserve(temp_log.size() + batch.size());
+
+   for (const auto& t: batch) {
+      validated.assign(t.begin(), t.end());
+      const bool valid = std::all_of(validated.begin(), validated.end(), [&validate](transfer& xfer) { return validate(xfer); });
+      if (!valid) {
+         status.push_back(push_status::invalid_account);
+         ++stats.rejected_transactions;
+         continue;
+      }
+
+      void* memory = arena->allocate(sizeof(transaction_log), alignof(transaction_log));
+      add_pending(new (memory) transaction_log(validated, current_transaction, accept, arena.get()));
+      status.push_back(push_status::accepted);
+      ++stats.accepted_transactions;
+      stats.validated_transfers += t.size();
+      if (wal) {
+         log_push(t, current_transaction - 1);
+      }
+   }
+
+   // one group commit for the whole batch
+   if (wal) {
+      end_push();
+   }
+   return status;
+}
+
+/**
+ * Validation only reads the account index, which nothing changes while an ingest is open, so it runs without a lock.
+ * Each producer thread keeps its own scratch buffer for the remapped transfers.
+ */
+template<typename Validator>
+push_status transaction_db::ingest_transaction(const transaction& t)
+{
+   static_assert(!std::is_same<Validator, auto_create_accounts>::value, "ingest_transaction can't create accounts.");
+   if (!ingest) {
+      throw std::logic_error("ingest_transaction needs begin_ingest first.");
+   }
+
+   Validator validate(*this);
+   thread_local transaction scratch;
+   scratch.assign(t.begin(), t.end());
+   if (!std::all_of(scratch.begin(), scratch.end(), [&validate](transfer& xfer) { return validate(xfer); })) {
+      ingest_rejected();
+      return push_status::invalid_account;
+   }
+
+   ingest_validated(scratch);
+   return push_status::accepted;
+}
+
+/**
+ * Both accounts must exist. They are rewritten to their dense index.
+ */
+inline bool accounts_must_exist::operator()(transfer& xfer) const
+{
+   auto to = db.account_index.find(xfer.to);
+   auto from = db.account_index.find(xfer.from);
+   if (to == db.account_index.end() || from == db.account_index.end()) {
+      return false;
+   }
+
+   xfer.to = static_cast<int>(to->second);
+   xfer.from = static_cast<int>(from->second);
+   return true;
+}
+
+/**
+ * Accounts that don't exist are created, so this never rejects a transfer.
+ */
+inline bool auto_create_accounts::operator()(transfer& xfer) const
+{
+   auto to = db.account_index.find(xfer.to);
+   xfer.to = static_cast<int>(to != db.account_index.end() ? to->second : db.add_account(xfer.to));
+
+   auto from = db.account_index.find(xfer.from);
+   xfer.from = static_cast<int>(from != db.account_index.end() ? from->second : db.add_account(xfer.from));
+   return true;
+}
+
+/**
+ * Reads the account count once, so every check is two compares.
+ */
+inline range_checked_dense_ids::range_checked_dense_ids(transaction_db& db): account_count(db.accounts.size())
+{
+   if (!db.dense_ids) {
+      throw std::logic_error("range_checked_dense_ids requires account_id's 0..N-1 in order.");
+   }
+}
+
+#endif // TRANSACTION_DB_HPP
@@ -0,0 +1,262 @@
+#include "workload_generator.hpp"
+
+#include <cmath>
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+/**
+ * @brief splitmix64. The standard distributions aren't specified bit for bit, so the generator does its own
+ *        arithmetic to keep a seed meaning the same workload with every standard library.
+ */
+class random_source {
+public:
+   explicit random_source(const uint64_t seed): state(seed) {}
+
+   uint64_t next()
+   {
+      uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+   }
+
+   /**
+    * @return uniform in [0, n). The modulo bias is far below anything a benchmark can see.
+    */
+   size_t below(const size_t n) { return static_cast<size_t>(next() % n); }
+
+   /**
+    * @return uniform in [0, 1).
+    */
+   double unit() { return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+   uint64_t state;
+};
+
+/**
+ * @brief Picks accounts, uniformly or Zipf distributed by account id (id 0 is the hottest).
+ */
+class account_picker {
+public:
+   account_picker(const size_t accounts, const double skew): accounts(accounts)
+   {
+      if (skew <= 0.0) {
+         return;
+      }
+
+      cdf.resize(accounts);
+      double total = 0.0;
+      for (size_t rank = 0; rank < accounts; ++rank) {
+         total += 1.0 / std::pow(static_cast<double>(rank + 1), skew);
+         cdf[rank] = total;
+      }
+      for (auto& c : cdf) {
+         c /= total;
+      }
+   }
+
+   int pick(random_source& rng) const
+   {
+      if (cdf.empty()) {
+         return static_cast<int>(rng.below(accounts));
+      }
+      const auto it = std::upper_bound(cdf.begin(), cdf.end(), rng.unit());
+      return static_cast<int>(std::min<size_t>(it - cdf.begin(), accounts - 1));
+   }
+
+   /**
+    * @return an account other than not.
+    */
+   int pick_other(random_source& rng, const int not_this) const
+   {
+      int account = pick(rng);
+      while (account == not_this) {
+         account = pick(rng);
+      }
+      return account;
+   }
+
+private:
+   const size_t accounts;
+   std::vector<double> cdf; ///< cumulative probability by account id, empty when uniform
+};
+
+/**
+ * @brief A chain whose first transaction has been emitted, waiting for the transactions that pay it back.
+ */
+struct open_chain {
+   size_t due;          ///< index of the transaction that carries the next payment
+   int account;         ///< the overdrawn account
+   long long owed;      ///< what the remaining members still have to pay
+   size_t members_left; ///< payments still to come
+
+   bool operator>(const open_chain& other) const { return due > other.due; }
+};
+
+static void check_options(const workload_options& o)
+{
+   if (o.accounts < 2 || o.accounts > static_cast<size_t>(std::numeric_limits<int>::max())) {
+      throw std::invalid_argument("A workload needs at least 2 accounts.");
+   }
+   if (o.transfers_per_transaction == 0) {
+      throw std::invalid_argument("A transaction needs at least 1 transfer.");
+   }
+   if (o.initial_balance < 0 || o.max_amount < 1) {
+      throw std::invalid_argument("Balances can't start negative and amounts must be at least 1.");
+   }
+   if (o.zipf_skew < 0.0) {
+      throw std::invalid_argument("Zipf skew can't be negative.");
+   }
+   if (o.overdraft_fraction < 0.0 || o.chain_fraction < 0.0 || o.overdraft_fraction + o.chain_fraction > 1.0) {
+      throw std::invalid_argument("Overdraft and chain fractions must be between 0 and 1 together.");
+   }
+   if (o.chain_fraction > 0.0 && o.chain_length < 2) {
+      throw std::invalid_argument("A chain needs at least 2 transactions.");
+   }
+}
+
+/**
+ * Everything below tracks balance, the state after every transaction emitted so far except the overdrafting ones.
+ * Ordinary transfers are clipped against it, or flipped around when their source is empty, which is what keeps the
+ * "drop only the overdrafts" guarantee.
+ */
+workload generate_workload(const workload_options& o)
+{
+   check_options(o);
+
+   random_source rng(o.seed);
+   const account_picker picker(o.accounts, o.zipf_skew);
+
+   workload w;
+   std::vector<long long> balance(o.accounts, o.initial_balance);
+   for (size_t i = 0; i < o.accounts; ++i) {
+      w.accounts.push_back({static_cast<int>(i), o.initial_balance});
+   }
+
+   // chain members take slots of their own, so the rolls on the remaining slots are scaled up to hit the requested shares
+   const double chain_starts = o.chain_fraction > 0.0 ? o.chain_fraction / o.chain_length : 0.0;
+   const double rolled_slots = 1.0 - chain_starts * (o.chain_length - 1);
+   const double overdraft_chance = o.overdraft_fraction / rolled_slots;
+   const double chain_chance = chain_starts / rolled_slots;
+
+   const auto random_amount = [&]() { return static_cast<long long>(1 + rng.below(o.max_amount)); };
+
+   const auto ordinary_transfer = [&](transaction& t, const bool apply) {
+      int from = picker.pick(rng);
+      int to = picker.pick_other(rng, from);
+      long long amount = random_amount();
+      if (apply) {
+         if (balance[from] <= 0) {
+            std::swap(from, to);
+         }
+         amount = std::max(0LL, std::min(amount, balance[from]));
+         balance[from] -= amount;
+         balance[to] += amount;
+      }
+      t.push_back({from, to, static_cast<int>(amount)});
+   };
+
+   // payers are sampled like any other account first, the scan for the richest account is a rare fallback
+   const auto find_payer = [&](const int payee, const long long amount) {
+      for (int tries = 0; tries < 32; ++tries) {
+         const int payer = picker.pick_other(rng, payee);
+         if (balance[payer] >= amount) {
+            return payer;
+         }
+      }
+      int richest = payee == 0 ? 1 : 0;
+      for (size_t i = 0; i < o.accounts; ++i) {
+         if (static_cast<int>(i) != payee && balance[i] > balance[richest]) {
+            richest = static_cast<int>(i);
+         }
+      }
+      return richest;
+   };
+
+   std::priority_queue<open_chain, std::vector<open_chain>, std::greater<open_chain>> chains;
+   size_t members_owed = 0; ///< payments still owed across every open chain
+
+   w.transactions.resize(o.transactions);
+   for (size_t i = 0; i < o.transactions; ++i) {
+      transaction& t = w.transactions[i];
+      const size_t slots_left = o.transactions - i;
+
+      if (!chains.empty() && (chains.top().due <= i || slots_left <= members_owed)) {
+         open_chain chain = chains.top();
+         chains.pop();
+         --members_owed;
+
+         const long long members_left = static_cast<long long>(chain.members_left);
+         const long long share = (chain.owed + members_left - 1) / members_left;
+         const int payer = find_payer(chain.account, share);
+         const long long paid = std::max(0LL, std::min(share, balance[payer]));
+         balance[payer] -= paid;
+         balance[chain.account] += paid;
+         t.push_back({payer, chain.account, static_cast<int>(paid)});
+
+         chain.owed -= paid;
+         if (--chain.members_left > 0) {
+            chain.due = i + 1 + rng.below(o.chain_spread + 1);
+            chains.push(chain);
+            ++members_owed;
+         }
+         while (t.size() < o.transfers_per_transaction) {
+            ordinary_transfer(t, true);
+         }
+         continue;
+      }
+
+      const double roll = rng.unit();
+      if (roll < overdraft_chance) {
+         // never applied to balance, settle is expected to drop it
+         const int from = picker.pick(rng);
+         const long long amount = std::max(0LL, balance[from]) + random_amount();
+         t.push_back({from, picker.pick_other(rng, from), static_cast<int>(std::min<long long>(amount, std::numeric_limits<int>::max()))});
+         while (t.size() < o.transfers_per_transaction) {
+            ordinary_transfer(t, false);
+         }
+      } else if (roll < overdraft_chance + chain_chance && slots_left > members_owed + o.chain_length - 1) {
+         const int account = picker.pick(rng);
+         const int to = picker.pick_other(rng, account);
+         const long long overdraw = random_amount();
+         const long long amount = std::max(0LL, balance[account]) + overdraw;
+         balance[account] -= amount;
+         balance[to] += amount;
+         t.push_back({account, to, static_cast<int>(std::min<long long>(amount, std::numeric_limits<int>::max()))});
+
+         chains.push({i + 1 + rng.below(o.chain_spread + 1), account, overdraw, o.chain_length - 1});
+         members_owed += o.chain_length - 1;
+         while (t.size() < o.transfers_per_transaction) {
+            ordinary_transfer(t, true);
+         }
+      } else {
+         while (t.size() < o.transfers_per_transaction) {
+            ordinary_transfer(t, true);
+         }
+      }
+   }
+   return w;
+}
+
+workload_options workload_preset(const std::string& name)
+{
+   workload_options o;
+   if (name == "uniform") {
+      return o;
+   } else if (name == "hot") {
+      o.zipf_skew = 1.1;
+   } else if (name == "overdraft") {
+      o.overdraft_fraction = 0.05;
+   } else if (name == "example4") {
+      o.chain_fraction = 0.5;
+      o.chain_length = 2;
+      o.max_amount = o.initial_balance / 2;
+   } else {
+      throw std::invalid_argument("Unknown workload preset " + name + ".");
+   }
+   return o;
+}
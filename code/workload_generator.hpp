@@ -0,0 +1,61 @@
+#ifndef WORKLOAD_GENERATOR_HPP
+#define WORKLOAD_GENERATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "transaction_db.hpp"
+
+/**
+ * @brief Knobs for generate_workload(). The defaults make a uniform workload where nothing overdraws.
+ */
+struct workload_options {
+   size_t accounts = 1000;                ///< account ids are 0 to accounts - 1
+   int initial_balance = 100;             ///< every account starts with this balance
+   size_t transactions = 10000;
+   size_t transfers_per_transaction = 2;
+   int max_amount = 10;                   ///< ordinary transfers move 1 to max_amount
+   double zipf_skew = 0.0;                ///< 0 picks accounts uniformly, around 1 makes the low account ids hot
+   double overdraft_fraction = 0.0;       ///< share of transactions that overdraw their first account and can only be dropped
+   double chain_fraction = 0.0;           ///< share of transactions that belong to a chain
+   size_t chain_length = 2;               ///< transactions per chain, the first overdraws and the rest pay it back
+   size_t chain_spread = 16;              ///< later chain members land up to this many transactions after the previous one
+   std::uint64_t seed = 1;
+};
+
+/**
+ * @brief Initial balances plus the transactions to push, in order.
+ */
+struct workload {
+   std::vector<account_balance> accounts;
+   std::vector<transaction> transactions;
+};
+
+/**
+ * @brief Builds a workload from options. The same options and seed always produce the same workload, on any platform.
+ *
+ *        Ordinary transactions never take an account below 0, given everything before them except the overdrafting
+ *        transactions. So dropping exactly the overdrafting transactions settles, and roughly
+ *        overdraft_fraction * transactions is an upper bound on what settle() needs to drop. The one exception is a chain
+ *        that can't find an account rich enough to pay it back, which only happens when the accounts run dry.
+ *
+ *        A chain is the pattern from the README's example 4: the first transaction overdraws an account, and only
+ *        the later members of the chain bring it back to 0 or more. Dropping any member of a chain leaves it broken.
+ *
+ * @throw std::invalid_argument For options that can't produce a workload, e.g. 0 accounts.
+ */
+workload generate_workload(const workload_options& options);
+
+/**
+ * @return options for a named preset, applied on top of the defaults:
+ *            uniform    - the defaults
+ *            hot        - zipf_skew 1.1, most traffic on a few accounts
+ *            overdraft  - 5% of transactions overdraw
+ *            example4   - README example 4 at scale: half the transactions are in pairs that only restore consistency together
+ * @throw std::invalid_argument For an unknown name.
+ */
+workload_options workload_preset(const std::string& name);
+
+#endif // WORKLOAD_GENERATOR_HPP
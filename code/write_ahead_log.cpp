@@ -0,0 +1,355 @@
+#include "write_ahead_log.hpp"
+
+#include <array>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+// records are copied to and from the file as raw bytes, so the host layout has to be the file layout
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The write-ahead log is read and written in host byte order, which must be little-endian.");
+static_assert(sizeof(account_balance) == 8 && std::is_trivially_copyable<account_balance>::value, "account_balance must match its on-disk record.");
+static_assert(sizeof(transfer) == 12 && std::is_trivially_copyable<transfer>::value, "transfer must match its on-disk record.");
+
+static const char wal_magic[4] = {'T', 'X', 'W', 'L'};
+static const size_t header_size = 16;
+static const size_t record_header_size = 8; ///< payload size and checksum
+
+/**
+ * CRC-32C (Castagnoli), one table lookup per byte. A push record is a few dozen bytes, so this is far from the
+ * bottleneck next to the write itself.
+ */
+static uint32_t crc32c(const char* data, const size_t size)
+{
+   static const array<uint32_t, 256> table = []() {
+      array<uint32_t, 256> t;
+      for (uint32_t i = 0; i < 256; ++i) {
+         uint32_t c = i;
+         for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+         }
+         t[i] = c;
+      }
+      return t;
+   }();
+
+   uint32_t crc = ~0u;
+   for (size_t i = 0; i < size; ++i) {
+      crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+   }
+   return ~crc;
+}
+
+/**
+ * Opens the file and either starts it over with a fresh header or cuts it back to keep_bytes. A reopened log carries
+ * on from the last record kept, so a snapshot taken before anything new is logged still finds its place.
+ */
+write_ahead_log::write_ahead_log(const char* path, const size_t keep_bytes, const std::uint64_t last_offset,
+                                 const std::uint32_t last_checksum, const wal_sync sync, const size_t group_bytes):
+                                 fd(-1), policy(sync), group_bytes(group_bytes), record_start(0), file_bytes(keep_bytes),
+                                 last_offset(keep_bytes ? last_offset : 0), last_checksum(keep_bytes ? last_checksum : 0)
+{
+   fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+   if (fd < 0) {
+      throw std::runtime_error(string("Could not open ") + path + ": " + strerror(errno));
+   }
+
+   if (::ftruncate(fd, static_cast<off_t>(keep_bytes)) != 0) {
+      const int error = errno;
+      ::close(fd);
+      throw std::runtime_error(string("Could not truncate ") + path + ": " + strerror(error));
+   }
+
+   if (keep_bytes == 0) {
+      const uint32_t header[3] = {wal_version, 0, 0};
+      put_bytes(wal_magic, sizeof(wal_magic));
+      put_bytes(header, sizeof(header));
+   }
+   buffer.reserve(group_bytes + 4096);
+}
+
+/**
+ * Whatever is still buffered is written, and synced unless the policy is wal_sync::none. Errors can't be reported
+ * from here, so they are ignored.
+ */
+write_ahead_log::~write_ahead_log()
+{
+   try {
+      write_buffer();
+      if (policy != wal_sync::none) {
+         sync_file();
+      }
+   } catch (std::exception&) {
+   }
+   ::close(fd);
+}
+
+void write_ahead_log::log_state(const std::vector<account_balance>& accounts, const size_t next_transaction, const std::vector<size_t>& applied)
+{
+   begin_record(wal_record_type::state);
+   put<uint64_t>(next_transaction);
+   put<uint64_t>(accounts.size());
+   put_bytes(accounts.data(), accounts.size() * sizeof(account_balance));
+   put<uint64_t>(applied.size());
+   for (const size_t id: applied) {
+      put<uint64_t>(id);
+   }
+   end_record();
+}
+
+void write_ahead_log::log_account(const int account_id)
+{
+   begin_record(wal_record_type::account);
+   put<int32_t>(account_id);
+   end_record();
+}
+
+void write_ahead_log::log_push(const size_t trans_id, array_view<const transfer> t)
+{
+   begin_record(wal_record_type::push);
+   put<uint64_t>(trans_id);
+   put<uint32_t>(static_cast<uint32_t>(t.size()));
+   put_bytes(t.begin(), t.size() * sizeof(transfer));
+   end_record();
+}
+
+void write_ahead_log::log_settle(const size_t first_pending, const size_t pending, const std::vector<size_t>& dropped)
+{
+   begin_record(wal_record_type::settle);
+   put<uint64_t>(first_pending);
+   put<uint64_t>(pending);
+   put<uint64_t>(dropped.size());
+   for (const size_t id: dropped) {
+      put<uint64_t>(id);
+   }
+   end_record();
+}
+
+/**
+ * Group commit: pushes only leave the buffer in group_bytes sized writes, so a batch of them costs one write()
+ * and at most one sync.
+ */
+void write_ahead_log::sync_point(const wal_sync level)
+{
+   if (level == wal_sync::push && policy != wal_sync::push) {
+      if (buffer.size() >= group_bytes) {
+         write_buffer();
+      }
+      return;
+   }
+
+   write_buffer();
+   if (policy != wal_sync::none) {
+      sync_file();
+   }
+}
+
+void write_ahead_log::flush()
+{
+   write_buffer();
+   sync_file();
+}
+
+/**
+ * Reserves room for the record header, filled in by end_record() once the payload size is known.
+ */
+void write_ahead_log::begin_record(const wal_record_type type)
+{
+   record_start = buffer.size();
+   buffer.resize(record_start + record_header_size);
+   put<uint8_t>(static_cast<uint8_t>(type));
+}
+
+void write_ahead_log::end_record()
+{
+   const char* payload = buffer.data() + record_start + record_header_size;
+   const uint32_t header[2] = {static_cast<uint32_t>(buffer.size() - record_start - record_header_size),
+                               crc32c(payload, buffer.size() - record_start - record_header_size)};
+   std::memcpy(buffer.data() + record_start, header, sizeof(header));
+   last_offset = file_bytes + record_start;
+   last_checksum = header[1];
+}
+
+/**
+ * Retries short writes and interrupts. The file is opened with O_APPEND, so every write lands at the end.
+ */
+void write_ahead_log::write_buffer()
+{
+   const char* p = buffer.data();
+   size_t left = buffer.size();
+   while (left > 0) {
+      const ssize_t written = ::write(fd, p, left);
+      if (written < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         throw std::runtime_error(string("Could not write the write-ahead log: ") + strerror(errno));
+      }
+      p += written;
+      left -= static_cast<size_t>(written);
+   }
+   file_bytes += buffer.size();
+   buffer.clear();
+}
+
+void write_ahead_log::sync_file()
+{
+#if defined(__APPLE__)
+   const int result = ::fsync(fd);
+#else
+   const int result = ::fdatasync(fd);
+#endif
+   if (result != 0) {
+      throw std::runtime_error(string("Could not sync the write-ahead log: ") + strerror(errno));
+   }
+}
+
+template<typename T>
+void write_ahead_log::put(const T& value)
+{
+   put_bytes(&value, sizeof(T));
+}
+
+void write_ahead_log::put_bytes(const void* p, const size_t bytes)
+{
+   const size_t at = buffer.size();
+   buffer.resize(at + bytes);
+   if (bytes != 0) {
+      std::memcpy(buffer.data() + at, p, bytes);
+   }
+}
+
+
+
+/**
+ * Reads fields out of one record's payload. The checksum already matched, so running out of bytes means the record
+ * was written wrong rather than torn.
+ */
+class payload_cursor {
+public:
+   payload_cursor(const char* first, const size_t size): p(first), left(size) {}
+
+   template<typename T>
+   T read()
+   {
+      T value;
+      std::memcpy(&value, take(sizeof(T)), sizeof(T));
+      return value;
+   }
+
+   template<typename T>
+   void read_array(std::vector<T>& out, const uint64_t count)
+   {
+      if (count > left / sizeof(T)) {
+         throw std::runtime_error("Malformed write-ahead log record.");
+      }
+      out.resize(static_cast<size_t>(count));
+      if (count != 0) {
+         std::memcpy(out.data(), take(out.size() * sizeof(T)), out.size() * sizeof(T));
+      }
+   }
+
+   void read_ids(std::vector<size_t>& out, const uint64_t count)
+   {
+      if (count > left / sizeof(uint64_t)) {
+         throw std::runtime_error("Malformed write-ahead log record.");
+      }
+      out.resize(static_cast<size_t>(count));
+      for (auto& id: out) {
+         id = static_cast<size_t>(read<uint64_t>());
+      }
+   }
+
+   bool done() const { return left == 0; }
+
+private:
+   const char* p;
+   size_t left;
+
+   const char* take(const size_t bytes)
+   {
+      if (bytes > left) {
+         throw std::runtime_error("Malformed write-ahead log record.");
+      }
+      const char* first = p;
+      p += bytes;
+      left -= bytes;
+      return first;
+   }
+};
+
+wal_reader::wal_reader(const char* path): file(path), offset(header_size), last(0), checksum(0)
+{
+   uint32_t version = 0;
+   if (file.size() < header_size || std::memcmp(file.data(), wal_magic, sizeof(wal_magic)) != 0) {
+      throw std::runtime_error(string(path) + " is not a write-ahead log.");
+   }
+   std::memcpy(&version, file.data() + sizeof(wal_magic), sizeof(version));
+   if (version != wal_version) {
+      throw std::runtime_error(string(path) + " has unsupported write-ahead log version " + to_string(version) + ".");
+   }
+}
+
+void wal_reader::seek(const size_t to)
+{
+   if (to < header_size || to > file.size()) {
+      throw std::runtime_error("Write-ahead log offset " + to_string(to) + " is out of range.");
+   }
+   offset = to;
+}
+
+/**
+ * offset only moves past a record once it checked out, so valid_bytes() ends up just past the last good one.
+ */
+bool wal_reader::next(wal_record& r)
+{
+   const size_t left = file.size() - offset;
+   if (left < record_header_size) {
+      return false;
+   }
+
+   uint32_t header[2];
+   std::memcpy(header, file.data() + offset, sizeof(header));
+   const size_t size = header[0];
+   const char* payload = file.data() + offset + record_header_size;
+   if (size == 0 || size > left - record_header_size || crc32c(payload, size) != header[1]) {
+      return false;
+   }
+
+   payload_cursor in(payload, size);
+   r.type = static_cast<wal_record_type>(in.read<uint8_t>());
+   switch (r.type) {
+   case wal_record_type::state:
+      r.transaction_id = static_cast<size_t>(in.read<uint64_t>());
+      in.read_array(r.accounts, in.read<uint64_t>());
+      in.read_ids(r.ids, in.read<uint64_t>());
+      break;
+   case wal_record_type::account:
+      r.account_id = in.read<int32_t>();
+      break;
+   case wal_record_type::push:
+      r.transaction_id = static_cast<size_t>(in.read<uint64_t>());
+      in.read_array(r.transfers, in.read<uint32_t>());
+      break;
+   case wal_record_type::settle:
+      r.transaction_id = static_cast<size_t>(in.read<uint64_t>());
+      r.transaction_count = static_cast<size_t>(in.read<uint64_t>());
+      in.read_ids(r.ids, in.read<uint64_t>());
+      break;
+   default:
+      throw std::runtime_error("Unknown write-ahead log record type " + to_string(static_cast<int>(r.type)) + ".");
+   }
+
+   if (!in.done()) {
+      throw std::runtime_error("Malformed write-ahead log record.");
+   }
+   last = offset;
+   offset += record_header_size + size;
+   checksum = header[1];
+   return true;
+}
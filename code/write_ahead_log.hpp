@@ -0,0 +1,166 @@
+#ifndef WRITE_AHEAD_LOG_HPP
+#define WRITE_AHEAD_LOG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "transaction_db.hpp"
+
+/**
+ * @brief Append-only log of everything that changes a transaction_db, enough to rebuild it after a crash.
+ *        Everything is little-endian.
+ *
+ *        Header (16 bytes):
+ *           char[4]  magic "TXWL"
+ *           uint32   version (wal_version)
+ *           uint32   reserved, always 0
+ *           uint32   reserved, always 0
+ *
+ *        Then records, back to back:
+ *           uint32   payload size in bytes
+ *           uint32   CRC-32C of the payload
+ *           uint8    wal_record_type         (first byte of the payload)
+ *           ...      the rest of the payload, by type:
+ *
+ *        state:    uint64 next transaction id, uint64 number of accounts, { int32 account_id, int32 balance } per account
+ *                  in dense index order, uint64 number of applied transactions, uint64 id per applied transaction.
+ *                  Always the first record, written by transaction_db::attach_wal().
+ *        account:  int32 account_id of an account created by a validation policy.
+ *        push:     uint64 transaction id, uint32 number of transfers, { int32 from, int32 to, int32 amount } per transfer,
+ *                  with the account ids as they were pushed.
+ *        settle:   uint64 first pending transaction id, uint64 number of pending transactions, uint64 number dropped,
+ *                  uint64 id per dropped transaction.
+ *
+ *        A crash can leave a record half written. The reader stops at the first record that runs past the end of the
+ *        file or fails its checksum, and recovery truncates the file there before appending again.
+ */
+constexpr std::uint32_t wal_version = 1;
+
+enum class wal_record_type : std::uint8_t { state = 1, account = 2, push = 3, settle = 4 };
+
+/**
+ * @brief One decoded record. Only the fields of its type are set, the vectors keep their capacity between records.
+ */
+struct wal_record {
+   wal_record_type type;
+   size_t transaction_id;                 ///< state: next transaction id. push: its id. settle: first pending id
+   size_t transaction_count;              ///< settle: pending transactions it decided
+   int account_id;                        ///< account: the new account
+   std::vector<account_balance> accounts; ///< state: every account in dense index order
+   std::vector<size_t> ids;               ///< state: applied transactions. settle: dropped transactions
+   transaction transfers;                 ///< push: the transaction as pushed
+};
+
+/**
+ * @brief Appends records to a log file. Records collect in a buffer and reach the file in groups,
+ *        see sync_point() for when that happens and when the file is synced to disk.
+ */
+class write_ahead_log {
+public:
+   /**
+    * @param keep_bytes  Bytes of an existing log to keep, anything after them is truncated. 0 starts a new log.
+    * @param last_offset   File offset of the last record kept, see wal_reader::last_offset(). 0 for a new log.
+    * @param last_checksum Checksum of the last record kept, see wal_reader::last_checksum(). 0 for a new log.
+    * @param sync        When the log is synced to disk, see wal_sync.
+    * @param group_bytes Pushes are written to the file once this many bytes are buffered, 0 writes every push call.
+    * @throw std::runtime_error If the file can't be opened, truncated or written.
+    */
+   write_ahead_log(const char* path, const size_t keep_bytes, const std::uint64_t last_offset, const std::uint32_t last_checksum,
+                   const wal_sync sync, const size_t group_bytes);
+   ~write_ahead_log();
+
+   write_ahead_log(const write_ahead_log&) = delete;
+   write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+   void log_state(const std::vector<account_balance>& accounts, const size_t next_transaction, const std::vector<size_t>& applied);
+   void log_account(const int account_id);
+   void log_push(const size_t trans_id, array_view<const transfer> t);
+   void log_settle(const size_t first_pending, const size_t pending, const std::vector<size_t>& dropped);
+
+   /**
+    * @brief Called when a push or settle call finishes, with level wal_sync::push or wal_sync::settle.
+    *        A settle always writes the buffer and syncs unless the policy is wal_sync::none. A push only writes once
+    *        group_bytes are buffered, and writes and syncs when the policy is wal_sync::push.
+    * @throw std::runtime_error If writing or syncing fails. The change is already applied in memory by then.
+    */
+   void sync_point(const wal_sync level);
+
+   /**
+    * @brief Writes the buffer and syncs the file, whatever the policy.
+    */
+   void flush();
+
+   /**
+    * @return file offset and checksum of the last record logged, which a snapshot uses to find its place in the log.
+    */
+   std::uint64_t last_record_offset() const { return last_offset; }
+   std::uint32_t last_record_checksum() const { return last_checksum; }
+
+private:
+   int fd;
+   const wal_sync policy;
+   const size_t group_bytes;
+   std::vector<char> buffer;    ///< records not written yet
+   size_t record_start;         ///< offset in buffer of the record being built
+   std::uint64_t file_bytes;    ///< bytes already in the file, buffer goes after them
+   std::uint64_t last_offset;   ///< file offset of the last record, 0 before the first one
+   std::uint32_t last_checksum; ///< checksum of the last record
+
+   void begin_record(const wal_record_type type);
+   void end_record();
+   void write_buffer();
+   void sync_file();
+
+   template<typename T>
+   void put(const T& value);
+   void put_bytes(const void* p, const size_t bytes);
+};
+
+/**
+ * @brief Reads a log front to back, stopping at the end of the file or a torn record.
+ */
+class wal_reader {
+public:
+   /**
+    * @throw std::runtime_error If the file can't be mapped or doesn't have a version 1 header.
+    */
+   explicit wal_reader(const char* path);
+
+   /**
+    * @brief Decodes the next intact record into r.
+    * @return false at the end of the log.
+    * @throw std::runtime_error If a record passes its checksum but doesn't decode, which a torn write can't cause.
+    */
+   bool next(wal_record& r);
+
+   /**
+    * @brief Moves to the record starting at offset, which next() reads as usual.
+    * @throw std::runtime_error If offset is past the end of the file.
+    */
+   void seek(const size_t offset);
+
+   /**
+    * @return bytes from the start of the file up to the end of the last intact record.
+    */
+   size_t valid_bytes() const { return offset; }
+
+   /**
+    * @return checksum of the record next() decoded last.
+    */
+   std::uint32_t last_checksum() const { return checksum; }
+
+   /**
+    * @return file offset of the record next() decoded last, 0 before the first one.
+    */
+   std::uint64_t last_offset() const { return last; }
+
+private:
+   mapped_file file;
+   size_t offset;          ///< start of the next record
+   size_t last;            ///< see last_offset()
+   std::uint32_t checksum; ///< see last_checksum()
+};
+
+#endif // WRITE_AHEAD_LOG_HPP